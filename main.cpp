@@ -3,12 +3,46 @@
 #include <sstream>
 #include <string>
 #include <iomanip>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <charconv>
+#include <limits>
+#ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 using namespace std;
 
 //======================================================
-// CONSOLE COLOR CODES FOR WINDOWS
+// CONSOLE COLOR CODES
+// (Windows console attribute numbering; Screen maps
+//  them to ANSI escape sequences)
 //======================================================
 #define BLACK 0
 #define BLUE 1
@@ -27,862 +61,7788 @@ using namespace std;
 #define LIGHT_YELLOW 14
 #define BRIGHT_WHITE 15
 
+#if defined(_WIN32) && !defined(ENABLE_VIRTUAL_TERMINAL_PROCESSING)
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+
+//======================================================
+// CLASS: Screen
+// Purpose: Portable terminal output. Text and colors are
+//          collected into one buffer and written with a single
+//          write when flush() is called (before reading input
+//          or at the end of a screen). Colors become ANSI
+//          sequences, and are dropped entirely when the stream
+//          is not a terminal or NO_COLOR is set.
+//======================================================
+class Screen {
+private:
+    string buffer;
+    FILE* stream;
+    bool terminal;
+    bool colorEnabled;
+    int currentColor;       // -1 until the first color is emitted
+
+public:
+    // Counters for --bench-render
+    size_t writeCalls;
+    size_t colorRequests;
+    size_t colorCodes;
+    size_t lineBreaks;
+
+    //======================================================
+    // CONSTRUCTOR: Screen
+    // Aim: Binds to stdout/stderr (or any FILE*) and detects
+    //      whether colors should be emitted
+    //======================================================
+    explicit Screen(FILE* target = stdout)
+        : stream(target), currentColor(-1), writeCalls(0), colorRequests(0), colorCodes(0), lineBreaks(0) {
+#ifdef _WIN32
+        terminal = _isatty(_fileno(target)) != 0;
+        if (terminal) {
+            HANDLE handle = GetStdHandle(target == stderr ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE);
+            DWORD mode = 0;
+            if (GetConsoleMode(handle, &mode)) {
+                SetConsoleMode(handle, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+            }
+        }
+#else
+        terminal = isatty(fileno(target)) != 0;
+#endif
+        colorEnabled = terminal && getenv("NO_COLOR") == nullptr;
+    }
+
+    ~Screen() {
+        flush();
+    }
+
+    bool isTerminal() const { return terminal; }
+    void setColorEnabled(bool enabled) { colorEnabled = enabled; }
+
+    //======================================================
+    // FUNCTION: redirect
+    // Aim: Sends later output to another stream
+    //======================================================
+    void redirect(FILE* target, bool withColor) {
+        flush();
+        stream = target;
+#ifdef _WIN32
+        terminal = _isatty(_fileno(target)) != 0;
+#else
+        terminal = isatty(fileno(target)) != 0;
+#endif
+        colorEnabled = withColor;
+        currentColor = -1;
+    }
+    const string& str() const { return buffer; }
+
+    //======================================================
+    // FUNCTION: color
+    // Aim: Switches the text color. Repeated requests for the
+    //      current color cost nothing.
+    //======================================================
+    Screen& color(int color) {
+        colorRequests++;
+        if (!colorEnabled || color == currentColor) return *this;
+        currentColor = color;
+        colorCodes++;
+
+        // Windows attribute bits are B=1, G=2, R=4, bright=8; ANSI wants R=1, G=2, B=4
+        int ansi = ((color & 4) ? 1 : 0) | (color & 2) | ((color & 1) ? 4 : 0);
+        char code[8];
+        int length = snprintf(code, sizeof(code), "\x1b[%dm", ((color & 8) ? 90 : 30) + ansi);
+        buffer.append(code, length);
+        return *this;
+    }
+
+    //======================================================
+    // FUNCTION: clearScreen
+    // Aim: Replaces system("cls"); only on a terminal
+    //======================================================
+    Screen& clearScreen() {
+        if (terminal) buffer += "\x1b[2J\x1b[H";
+        return *this;
+    }
+
+    Screen& operator<<(string_view text) {
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] == '\n') lineBreaks++;
+        }
+        buffer.append(text.data(), text.size());
+        return *this;
+    }
+    Screen& operator<<(const char* text) { return *this << string_view(text); }
+    Screen& operator<<(const string& text) { return *this << string_view(text); }
+    Screen& operator<<(char c) { return *this << string_view(&c, 1); }
+    Screen& operator<<(int value) { return *this << string_view(to_string(value)); }
+
+    //======================================================
+    // FUNCTION: padLeft / padRight
+    // Aim: Right- or left-aligns text in a column of width,
+    //      like setw and setw << left on a stream
+    //======================================================
+    Screen& padLeft(string_view text, size_t width) {
+        if (text.size() < width) buffer.append(width - text.size(), ' ');
+        return *this << text;
+    }
+    Screen& padRight(string_view text, size_t width) {
+        *this << text;
+        if (text.size() < width) buffer.append(width - text.size(), ' ');
+        return *this;
+    }
+
+    //======================================================
+    // FUNCTION: flush
+    // Aim: Writes the whole buffer in one go
+    //======================================================
+    void flush() {
+        if (buffer.empty()) return;
+        fflush(stream);     // keep order with anything written through stdio/iostream
+#ifdef _WIN32
+        fwrite(buffer.data(), 1, buffer.size(), stream);
+        fflush(stream);
+        writeCalls++;
+#else
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = ::write(fileno(stream), buffer.data() + written, buffer.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            written += (size_t)n;
+            writeCalls++;
+        }
+#endif
+        buffer.clear();
+    }
+};
+
 //======================================================
-// FUNCTION: setColor
-// Aim: Sets console text color using Windows API
+// FUNCTION: pause
+// Aim: Portable replacement for Sleep (milliseconds)
 //======================================================
-void setColor(int color) {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    SetConsoleTextAttribute(hConsole, color);
+void pause(int milliseconds) {
+    this_thread::sleep_for(chrono::milliseconds(milliseconds));
 }
 
 //======================================================
-// STRUCTURE: Utterance
-// Purpose: Stores a chatbot input and its corresponding response
+// ALLOCATION COUNTER
+// Built in with -DLOANBUDDY_ALLOC_COUNT. The global operator
+// new then counts the heap allocations of each thread, so the
+// replay harness and --alloc-check can report allocations per
+// turn, at one thread-local increment per allocation. The
+// plain and aligned forms are replaced; the array and nothrow
+// forms call them, so every new is counted. Without the flag
+// the standard operators stay and the counters stay at zero.
 //======================================================
-struct Utterance {
-    string input;
-    string response;
+struct AllocationCounter {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+thread_local AllocationCounter allocations = { 0, 0 };
+
+#ifdef LOANBUDDY_ALLOC_COUNT
+static const bool ALLOCATIONS_COUNTED = true;
+
+void* operator new(size_t size) {
+    allocations.count++;
+    allocations.bytes += size;
+    while (true) {
+        void* memory = malloc(size > 0 ? size : 1);
+        if (memory != nullptr) return memory;
+        new_handler handler = get_new_handler();
+        if (handler == nullptr) throw bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    allocations.count++;
+    allocations.bytes += size;
+    size_t align = (size_t)alignment;
+    size_t rounded = (max(size, (size_t)1) + align - 1) / align * align;
+    while (true) {
+#ifdef _WIN32
+        void* memory = _aligned_malloc(rounded, align);
+#else
+        void* memory = aligned_alloc(align, rounded);
+#endif
+        if (memory != nullptr) return memory;
+        new_handler handler = get_new_handler();
+        if (handler == nullptr) throw bad_alloc();
+        handler();
+    }
+}
+
+// GCC inlines these into delete expressions and then warns that
+// free() gets memory from operator new, which is exactly the intent
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+void operator delete(void* memory, size_t, align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+static const bool ALLOCATIONS_COUNTED = false;
+#endif
+
+//======================================================
+// FUNCTION: noteUncountedAllocations
+// Aim: Tells a harness reader that the allocation figures
+//      are zero because this build does not count them
+//======================================================
+void noteUncountedAllocations() {
+    if (!ALLOCATIONS_COUNTED) cout << "  (allocations are counted only in builds with -DLOANBUDDY_ALLOC_COUNT)" << endl;
+}
+
+//======================================================
+// METRICS
+// Built in with -DLOANBUDDY_METRICS. Every thread counts into
+// its own block of relaxed atomics (one writer, no locks, no
+// shared cache lines); a dump sums the blocks of all threads.
+// Stage latencies go into log2 nanosecond histograms. Without
+// the flag the METRIC_* macros expand to nothing.
+//======================================================
+#ifdef LOANBUDDY_METRICS
+
+enum MetricCounter {
+    METRIC_TURNS,
+    METRIC_EXACT_HITS,
+    METRIC_FUZZY_HITS,
+    METRIC_DEFAULT_RESPONSES,
+    METRIC_OPTION_SELECTIONS,
+    METRIC_PLANS,
+    METRIC_RELOADS,
+    METRIC_RELOAD_FAILURES,
+    METRIC_FILTERS,
+    METRIC_COUNTER_COUNT
+};
+
+static const char* const METRIC_COUNTER_NAMES[METRIC_COUNTER_COUNT] = {
+    "turns_total", "intent_exact_hits_total", "intent_fuzzy_hits_total", "intent_default_responses_total",
+    "option_selections_total", "plans_total", "catalog_reloads_total", "catalog_reload_failures_total",
+    "filter_queries_total"
+};
+
+enum TimedStage {
+    TIMED_LOAD_CATALOG,
+    TIMED_LOAD_TABLE,
+    TIMED_MATCH,
+    TIMED_SELECTION,
+    TIMED_PLAN,
+    TIMED_FILTER,
+    TIMED_STAGE_COUNT
+};
+
+static const char* const TIMED_STAGE_NAMES[TIMED_STAGE_COUNT] = {
+    "load_catalog", "load_loan_table", "match", "selection", "plan", "filter"
 };
 
+static const int METRIC_PRODUCTS = 16;          // picks of later products are not counted
+static const int METRIC_CATEGORIES = 64;        // picks of later categories count as "other"
+static const int HISTOGRAM_BUCKETS = 38;        // bucket b: below 2^b ns; the last is +Inf
+
 //======================================================
-// STRUCTURE: LoanOption
-// Purpose: Stores information about a specific home loan option
+// STRUCTURE: ThreadMetrics
+// Purpose: Counters of one thread. Only the owning thread
+//          writes, so a bump is a relaxed load and store.
 //======================================================
-struct LoanOption {
-    string category;
-    string details;
-    string installments;
-    string price;
-    string downPayment;
+struct alignas(64) ThreadMetrics {
+    atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+    atomic<uint64_t> categoryPicks[METRIC_PRODUCTS][METRIC_CATEGORIES + 1];
+    atomic<uint64_t> buckets[TIMED_STAGE_COUNT][HISTOGRAM_BUCKETS];
+    atomic<uint64_t> totalNanoseconds[TIMED_STAGE_COUNT];
+
+    ThreadMetrics() {
+        for (auto& counter : counters) counter.store(0, memory_order_relaxed);
+        for (auto& product : categoryPicks) for (auto& picks : product) picks.store(0, memory_order_relaxed);
+        for (auto& stage : buckets) for (auto& bucket : stage) bucket.store(0, memory_order_relaxed);
+        for (auto& total : totalNanoseconds) total.store(0, memory_order_relaxed);
+    }
+
+    static void bump(atomic<uint64_t>& value, uint64_t amount = 1) {
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
 };
 
 //======================================================
-// CLASS: LoanApplicationSystem
-// Purpose: Handles chatbot interaction and home loan information
+// STRUCTURE: MetricTotals
+// Purpose: Sum of all thread blocks at one moment
 //======================================================
-class LoanApplicationSystem {
+struct MetricTotals {
+    uint64_t counters[METRIC_COUNTER_COUNT] = {};
+    uint64_t categoryPicks[METRIC_PRODUCTS][METRIC_CATEGORIES + 1] = {};
+    uint64_t buckets[TIMED_STAGE_COUNT][HISTOGRAM_BUCKETS] = {};
+    uint64_t totalNanoseconds[TIMED_STAGE_COUNT] = {};
+};
+
+//======================================================
+// CLASS: MetricsRegistry
+// Purpose: Owns the block of every thread that ever counted
+//          something. Blocks outlive their threads so their
+//          counts stay in the totals.
+//======================================================
+class MetricsRegistry {
 private:
-    Utterance* utterances;
-    int utteranceCount;
-    int utteranceCapacity;
+    mutex lock;
+    vector<unique_ptr<ThreadMetrics>> blocks;
+
+public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry* registry = new MetricsRegistry();     // never destroyed: threads may count during exit
+        return *registry;
+    }
 
-    LoanOption* homeLoanOptions;
-    int homeCount;
-    int homeCapacity;
+    ThreadMetrics* add() {
+        lock_guard<mutex> guard(lock);
+        blocks.push_back(unique_ptr<ThreadMetrics>(new ThreadMetrics()));
+        return blocks.back().get();
+    }
 
-    LoanOption* carLoanOptions;
-    int carCount;
-    int carCapacity;
+    MetricTotals totals() {
+        MetricTotals sum;
+        lock_guard<mutex> guard(lock);
+        for (const auto& block : blocks) {
+            for (int i = 0; i < METRIC_COUNTER_COUNT; i++) sum.counters[i] += block->counters[i].load(memory_order_relaxed);
+            for (int p = 0; p < METRIC_PRODUCTS; p++) {
+                for (int c = 0; c <= METRIC_CATEGORIES; c++) sum.categoryPicks[p][c] += block->categoryPicks[p][c].load(memory_order_relaxed);
+            }
+            for (int s = 0; s < TIMED_STAGE_COUNT; s++) {
+                for (int b = 0; b < HISTOGRAM_BUCKETS; b++) sum.buckets[s][b] += block->buckets[s][b].load(memory_order_relaxed);
+                sum.totalNanoseconds[s] += block->totalNanoseconds[s].load(memory_order_relaxed);
+            }
+        }
+        return sum;
+    }
+};
 
-    LoanOption* bikeLoanOptions;
-    int bikeCount;
-    int bikeCapacity;
+//======================================================
+// FUNCTION: threadMetrics
+// Aim: Block of the calling thread, registered on first use
+//======================================================
+inline ThreadMetrics& threadMetrics() {
+    thread_local ThreadMetrics* block = nullptr;
+    if (block == nullptr) block = MetricsRegistry::instance().add();
+    return *block;
+}
 
-    string defaultResponse;
-    string chatbotName;
+inline void countMetric(MetricCounter counter) {
+    ThreadMetrics::bump(threadMetrics().counters[counter]);
+}
+
+inline void countCategoryPick(int product, int category) {
+    if (product < 0 || product >= METRIC_PRODUCTS || category < 0) return;
+    ThreadMetrics::bump(threadMetrics().categoryPicks[product][min(category, METRIC_CATEGORIES)]);
+}
+
+//======================================================
+// CLASS: StageTimer
+// Purpose: Adds the lifetime of a scope to a stage histogram
+//======================================================
+class StageTimer {
+private:
+    TimedStage stage;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit StageTimer(TimedStage timedStage) : stage(timedStage), start(chrono::steady_clock::now()) {}
+
+    ~StageTimer() {
+        uint64_t nanoseconds = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        int bucket = 0;
+        for (uint64_t rest = nanoseconds; rest != 0 && bucket < HISTOGRAM_BUCKETS - 1; rest >>= 1) bucket++;
+        ThreadMetrics& block = threadMetrics();
+        ThreadMetrics::bump(block.buckets[stage][bucket]);
+        ThreadMetrics::bump(block.totalNanoseconds[stage], nanoseconds);
+    }
+};
+
+//======================================================
+// FUNCTION: deliverMetrics
+// Aim: Writes a dump to stdout ("-"), to a listening Unix
+//      socket, or to a file (replaced atomically through a
+//      temporary file so readers never see half a dump)
+//======================================================
+bool deliverMetrics(const string& path, const string& text) {
+    if (path == "-") {
+        fwrite(text.data(), 1, text.size(), stdout);
+        fflush(stdout);
+        return true;
+    }
+#ifndef _WIN32
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        sockaddr_un address = {};
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socketFd < 0) return false;
+        bool sent = connect(socketFd, (const sockaddr*)&address, sizeof(address)) == 0;
+        for (size_t written = 0; sent && written < text.size();) {
+            ssize_t n = ::write(socketFd, text.data() + written, text.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            sent = n > 0;
+            if (sent) written += (size_t)n;
+        }
+        close(socketFd);
+        return sent;
+    }
+#endif
+    string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = fclose(file) == 0 && written;
+    error_code error;
+    if (written) filesystem::rename(temporary, path, error);
+    return written && !error;
+}
+
+#define METRIC_COUNT(counter) countMetric(counter)
+#define METRIC_CATEGORY_PICK(product, category) countCategoryPick(product, category)
+#define METRIC_TIME(stage) StageTimer stageTimer(stage)
+
+#else
+
+#define METRIC_COUNT(counter) ((void)0)
+#define METRIC_CATEGORY_PICK(product, category) ((void)0)
+#define METRIC_TIME(stage) ((void)0)
+
+#endif
+
+//======================================================
+// CLASS: MappedFile
+// Purpose: Read-only view of a whole file. The file is memory
+//          mapped where possible (mmap / MapViewOfFile) and read
+//          into one buffer otherwise, so the loaders can split
+//          it in place without per-line copies.
+//======================================================
+class MappedFile {
+private:
+    const char* begin;
+    size_t length;
+    vector<char> fallback;      // contents when the file could not be mapped
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 
     //======================================================
-    // FUNCTION: trim
-    // Aim: Removes whitespace (spaces, tabs, newlines) from
-    //      the beginning and end of a string.
+    // FUNCTION: readFallback
+    // Aim: Reads the file the ordinary way
     //======================================================
-    string trim(const string& str) {
-        size_t first = str.find_first_not_of(" \t\r\n");
-        if (first == string::npos) return "";
-        size_t last = str.find_last_not_of(" \t\r\n");
-        return str.substr(first, last - first + 1);
+    bool readFallback(const string& filename) {
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) return false;
+        fallback.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        begin = fallback.data();
+        length = fallback.size();
+        return true;
+    }
+
+public:
+    MappedFile() : begin(nullptr), length(0) {
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = nullptr;
+#endif
+    }
+
+    ~MappedFile() {
+        close();
     }
 
     //======================================================
-    // FUNCTION: toLower
-    // Aim: Converts all uppercase characters in a string
-    //      to lowercase for case-insensitive comparison.
+    // FUNCTION: open
+    // Aim: Maps filename; returns false if it cannot be read
     //======================================================
-    string toLower(string str) {
-        for (size_t i = 0; i < str.length(); i++) {
-            if (str[i] >= 'A' && str[i] <= 'Z') {
-                str[i] = str[i] + 32;
+    bool open(const string& filename) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(fileHandle, &size) && size.QuadPart > 0) {
+            mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mappingHandle != nullptr) {
+                begin = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+                if (begin != nullptr) {
+                    length = (size_t)size.QuadPart;
+                    return true;
+                }
             }
         }
-        return str;
+        close();
+        return readFallback(filename);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                madvise(address, (size_t)info.st_size, MADV_SEQUENTIAL);
+                ::close(fd);
+                begin = (const char*)address;
+                length = (size_t)info.st_size;
+                return true;
+            }
+        }
+        ::close(fd);
+        return readFallback(filename);
+#endif
     }
+
     //======================================================
-    // FUNCTION: isValidNumber
-    // Aim: Checks if string contains only digits
+    // FUNCTION: close
+    // Aim: Unmaps the file and frees the fallback buffer
     //======================================================
-    bool isValidNumber(const string& str) {
-    if (str.empty()) return false;
-    for (size_t i = 0; i < str.length(); i++) {
-        if (str[i] < '0' || str[i] > '9') {
-            return false;
+    void close() {
+        bool mapped = begin != nullptr && fallback.empty();
+#ifdef _WIN32
+        if (mapped) UnmapViewOfFile(begin);
+        if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped) munmap((void*)begin, length);
+#endif
+        vector<char>().swap(fallback);
+        begin = nullptr;
+        length = 0;
+    }
+
+    string_view view() const { return string_view(begin, length); }
+};
+
+//======================================================
+// CLASS: StringArena
+// Purpose: Owns every byte the loaded records point at: the
+//          mapped files themselves, plus large chunks for the
+//          few strings that have to be rewritten (lowercased
+//          keys). Records hold string_views into it, so it must
+//          live as long as the records do.
+//======================================================
+class StringArena {
+private:
+    vector<unique_ptr<MappedFile>> files;
+    vector<unique_ptr<char[]>> chunks;
+    char* cursor;
+    size_t remaining;
+
+public:
+    StringArena() : cursor(nullptr), remaining(0) {}
+
+    //======================================================
+    // FUNCTION: map
+    // Aim: Maps a file for the arena's lifetime. Returns false
+    //      and leaves contents empty if it cannot be opened.
+    //======================================================
+    bool map(const string& filename, string_view& contents) {
+        unique_ptr<MappedFile> file(new MappedFile());
+        if (!file->open(filename)) return false;
+        contents = file->view();
+        files.push_back(move(file));
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: allocate
+    // Aim: Bump-allocates size bytes from the current chunk
+    //======================================================
+    char* allocate(size_t size) {
+        if (size > remaining) {
+            size_t chunkSize = size > 65536 ? size : 65536;
+            chunks.push_back(unique_ptr<char[]>(new char[chunkSize]));
+            cursor = chunks.back().get();
+            remaining = chunkSize;
         }
+        char* result = cursor;
+        cursor += size;
+        remaining -= size;
+        return result;
     }
-    return true;
-}
 
     //======================================================
-    // FUNCTION: stringToDouble
-    // Aim: Converts string to double, removing commas
+    // FUNCTION: store
+    // Aim: Copies text into the arena
     //======================================================
-     double stringToDouble(const string& str) {
-     string numStr = "";
-     for (size_t i = 0; i < str.length(); i++) {
-        if (str[i] != ',') {
-            numStr += str[i];
+    string_view store(string_view text) {
+        if (text.empty()) return string_view();
+        char* copy = allocate(text.size());
+        memcpy(copy, text.data(), text.size());
+        return string_view(copy, text.size());
+    }
+
+    //======================================================
+    // FUNCTION: storeLower
+    // Aim: ASCII-lowercased view of text. Text that is already
+    //      lowercase is returned as is, without a copy.
+    //======================================================
+    string_view storeLower(string_view text) {
+        size_t i = 0;
+        while (i < text.size() && !(text[i] >= 'A' && text[i] <= 'Z')) i++;
+        if (i == text.size()) return text;
+
+        char* copy = allocate(text.size());
+        for (size_t j = 0; j < text.size(); j++) {
+            char c = text[j];
+            copy[j] = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
         }
+        return string_view(copy, text.size());
+    }
+};
+
+//======================================================
+// FUNCTION: trimView
+// Aim: Whitespace-trimmed view, no copy
+//======================================================
+string_view trimView(string_view text) {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == string_view::npos) return string_view();
+    size_t last = text.find_last_not_of(" \t\r\n");
+    return text.substr(first, last - first + 1);
+}
+
+//======================================================
+// FUNCTION: nextField
+// Aim: Splits the next field off text at delimiter (memchr,
+//      which is vectorized in common C libraries) and
+//      advances text past it
+//======================================================
+string_view nextField(string_view& text, char delimiter) {
+    const char* found = (const char*)memchr(text.data(), delimiter, text.size());
+    size_t length = found ? (size_t)(found - text.data()) : text.size();
+    string_view field = text.substr(0, length);
+    text.remove_prefix(found ? length + 1 : length);
+    return field;
+}
+
+//======================================================
+// FUNCTION: countLines
+// Aim: Upper bound on the records in a file, used to size
+//      the arrays once instead of doubling them
+//======================================================
+int countLines(string_view text) {
+    int lines = 0;
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end) {
+        const char* found = (const char*)memchr(p, '\n', end - p);
+        lines++;
+        if (found == nullptr) break;
+        p = found + 1;
     }
-    return atof(numStr.c_str());
+    return lines;
+}
+
+//======================================================
+// FUNCTION: runTasks
+// Aim: Runs task(0) .. task(count - 1) on up to threads
+//      threads, the calling one included. Each thread takes
+//      the next task number until none are left.
+//======================================================
+template <class Task>
+void runTasks(int count, int threads, Task task) {
+    atomic<int> next(0);
+    auto work = [&]() {
+        for (int i = next++; i < count; i = next++) task(i);
+    };
+    vector<thread> helpers;
+    for (int t = 1; t < min(threads, count); t++) helpers.emplace_back(work);
+    work();
+    for (thread& helper : helpers) helper.join();
 }
 
+static const size_t LOAD_CHUNK_BYTES = 1 << 20;     // loan table bytes per parsing task
+
+//======================================================
+// STRUCTURE: Utterance
+// Purpose: Stores a chatbot input and its corresponding response
+//======================================================
+struct Utterance {
+    string_view input;      // normalized; both views point into the catalog arena or the built-in tables
+    string_view response;
+};
+
+//======================================================
+// CLASS: HashIndex
+// Purpose: Open-addressing hash table (linear probing) that maps
+//          string keys to integer values. Keys are copied into one
+//          contiguous pool and every slot keeps its precomputed hash,
+//          so a lookup touches one slot array and one pool.
+//          The first value inserted for a key wins.
+//          An index can also adopt a prebuilt slot array and
+//          pool from a catalog image and search it in place.
+//======================================================
+class HashIndex {
+public:
+    struct Slot {
+        uint32_t hash;
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        int32_t value;      // -1 marks an empty slot
+    };
+
+private:
+    vector<Slot> slots;
+    string keyPool;
+    size_t used;
+
+    // What find() searches: the vectors above, or adopted memory
+    const Slot* table;
+    size_t tableSize;
+    const char* pool;
+    size_t poolSize;
+
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+
+    //======================================================
+    // FUNCTION: refresh
+    // Aim: Points the search view back at the owned storage
+    //======================================================
+    void refresh() {
+        table = slots.data();
+        tableSize = slots.size();
+        pool = keyPool.data();
+        poolSize = keyPool.size();
+    }
+
+    //======================================================
+    // FUNCTION: own
+    // Aim: Copies adopted slots and pool into owned storage
+    //      before the index is modified
+    //======================================================
+    void own() {
+        if (table == slots.data()) return;
+        vector<Slot>(table, table + tableSize).swap(slots);
+        keyPool.assign(pool, poolSize);
+        refresh();
+    }
+
+    //======================================================
+    // FUNCTION: grow
+    // Aim: Doubles the slot array and reinserts all entries.
+    //      Stored hashes are reused, keys are not rehashed.
+    //======================================================
+    void grow() {
+        vector<Slot> oldSlots;
+        oldSlots.swap(slots);
+        slots.assign(oldSlots.empty() ? 16 : oldSlots.size() * 2, Slot{ 0, 0, 0, -1 });
+        size_t mask = slots.size() - 1;
+        for (size_t i = 0; i < oldSlots.size(); i++) {
+            if (oldSlots[i].value < 0) continue;
+            size_t pos = oldSlots[i].hash & mask;
+            while (slots[pos].value >= 0) {
+                pos = (pos + 1) & mask;
+            }
+            slots[pos] = oldSlots[i];
+        }
+        refresh();
+    }
+
+public:
+    HashIndex() : used(0) {
+        refresh();
+    }
+
+    //======================================================
+    // FUNCTION: hashKey
+    // Aim: FNV-1a hash folded to 32 bits
+    //======================================================
+    static uint32_t hashKey(string_view key) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < key.size(); i++) {
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        return (uint32_t)(h ^ (h >> 32));
+    }
+
+    //======================================================
+    // FUNCTION: clear
+    // Aim: Removes all keys
+    //======================================================
+    void clear() {
+        slots.clear();
+        keyPool.clear();
+        used = 0;
+        refresh();
+    }
+
+    //======================================================
+    // FUNCTION: reserve
+    // Aim: Sizes the table for the expected number of keys
+    //      so loading does not rehash repeatedly.
+    //======================================================
+    void reserve(size_t count) {
+        own();
+        size_t wanted = 16;
+        while (wanted < count * 2) wanted *= 2;
+        while (slots.size() < wanted) grow();
+    }
+
+    //======================================================
+    // FUNCTION: insert
+    // Aim: Adds key -> value. Returns false (and keeps the old
+    //      value) if the key is already present.
+    //======================================================
+    bool insert(string_view key, int value) {
+        own();
+        if ((used + 1) * 2 > slots.size()) {
+            grow();
+        }
+        uint32_t h = hashKey(key);
+        size_t mask = slots.size() - 1;
+        size_t pos = h & mask;
+        while (slots[pos].value >= 0) {
+            const Slot& s = slots[pos];
+            if (s.hash == h && s.keyLength == key.size() &&
+                memcmp(keyPool.data() + s.keyOffset, key.data(), key.size()) == 0) {
+                return false;
+            }
+            pos = (pos + 1) & mask;
+        }
+        slots[pos].hash = h;
+        slots[pos].keyOffset = (uint32_t)keyPool.size();
+        slots[pos].keyLength = (uint32_t)key.size();
+        slots[pos].value = value;
+        keyPool.append(key.data(), key.size());
+        used++;
+        refresh();
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: find
+    // Aim: Returns the value stored for key, or -1
+    //======================================================
+    int find(string_view key) const {
+        if (used == 0) return -1;
+        uint32_t h = hashKey(key);
+        size_t mask = tableSize - 1;
+        size_t pos = h & mask;
+        while (table[pos].value >= 0) {
+            const Slot& s = table[pos];
+            if (s.hash == h && s.keyLength == key.size() &&
+                memcmp(pool + s.keyOffset, key.data(), key.size()) == 0) {
+                return s.value;
+            }
+            pos = (pos + 1) & mask;
+        }
+        return -1;
+    }
+
+    //======================================================
+    // FUNCTION: adopt
+    // Aim: Searches count keys in prebuilt slots and pool that
+    //      the caller keeps alive. Returns false (index left
+    //      empty) if they are not a valid table or a value is
+    //      not below valueLimit.
+    //======================================================
+    bool adopt(const Slot* slotData, size_t slotCount, string_view keyData, size_t count, int valueLimit) {
+        clear();
+        if (slotCount == 0) return count == 0;
+        if ((slotCount & (slotCount - 1)) != 0 || count * 2 > slotCount) return false;
+
+        size_t filled = 0;
+        for (size_t i = 0; i < slotCount; i++) {
+            const Slot& s = slotData[i];
+            if (s.value < 0) continue;
+            if (s.value >= valueLimit || (uint64_t)s.keyOffset + s.keyLength > keyData.size()) return false;
+            filled++;
+        }
+        if (filled != count) return false;
+
+        table = slotData;
+        tableSize = slotCount;
+        pool = keyData.data();
+        poolSize = keyData.size();
+        used = count;
+        return true;
+    }
+
+    size_t size() const { return used; }
+    size_t slotCount() const { return tableSize; }
+    const Slot* slotData() const { return table; }
+    string_view keyData() const { return string_view(pool, poolSize); }
+};
+
+//======================================================
+// STRUCTURE: Money
+// Purpose: An amount of rupees held as whole paisa (1/100
+//          rupee) in 64 bits. Sums and differences are exact.
+//          Rate math runs in double, and each of its results
+//          is rounded back to paisa, halves away from zero.
+//======================================================
+struct Money {
+    int64_t paisa = 0;
+
+    static constexpr int64_t LIMIT = 900000000000000000LL;     // 9e15 rupees, far below int64
+
+    static Money fromPaisa(int64_t amount) {
+        Money money;
+        money.paisa = amount;
+        return money;
+    }
+
+    //======================================================
+    // FUNCTION: round
+    // Aim: Rounds an amount in (fractional) paisa to whole
+    //      paisa; out-of-range amounts saturate
+    //======================================================
+    static Money round(double paisaAmount) {
+        if (!(paisaAmount > -(double)LIMIT)) return fromPaisa(paisaAmount != paisaAmount ? 0 : -LIMIT);
+        if (!(paisaAmount < (double)LIMIT)) return fromPaisa(LIMIT);
+        return fromPaisa(llround(paisaAmount));
+    }
+
+    static Money fromRupees(double rupees) { return round(rupees * 100.0); }
+
+    //======================================================
+    // FUNCTION: parse
+    // Aim: Parses an amount such as "10,000,000" or "1,250.50"
+    //      exactly. Digits past the paisa round half up.
+    //      Returns false on anything else.
+    //======================================================
+    static bool parse(string_view text, Money& value) {
+        int64_t whole = 0;
+        int64_t fraction = 0;       // paisa
+        int fractionDigits = 0;
+        bool roundUp = false;
+        bool seenDigit = false;
+        bool inFraction = false;
+        for (size_t i = 0; i < text.length(); i++) {
+            char c = text[i];
+            if (c >= '0' && c <= '9') {
+                seenDigit = true;
+                if (!inFraction) {
+                    whole = whole * 10 + (c - '0');
+                    if (whole > LIMIT / 100) return false;
+                }
+                else if (fractionDigits < 2) {
+                    fraction = fraction * 10 + (c - '0');
+                    fractionDigits++;
+                }
+                else if (fractionDigits++ == 2) {
+                    roundUp = c >= '5';
+                }
+            }
+            else if (c == ',' && !inFraction) {
+                continue;
+            }
+            else if (c == '.' && !inFraction) {
+                inFraction = true;
+            }
+            else {
+                return false;
+            }
+        }
+        if (fractionDigits == 1) fraction *= 10;
+        value.paisa = whole * 100 + fraction + (roundUp ? 1 : 0);
+        return seenDigit;
+    }
+
+    double rupees() const { return paisa / 100.0; }
+
+    Money operator+(Money other) const { return fromPaisa(paisa + other.paisa); }
+    Money operator-(Money other) const { return fromPaisa(paisa - other.paisa); }
+    Money operator*(int64_t count) const { return fromPaisa(paisa * count); }
+    Money& operator+=(Money other) { paisa += other.paisa; return *this; }
+    Money& operator-=(Money other) { paisa -= other.paisa; return *this; }
+    bool operator==(Money other) const { return paisa == other.paisa; }
+    bool operator!=(Money other) const { return paisa != other.paisa; }
+    bool operator<(Money other) const { return paisa < other.paisa; }
+    bool operator<=(Money other) const { return paisa <= other.paisa; }
+    bool operator>(Money other) const { return paisa > other.paisa; }
+    bool operator>=(Money other) const { return paisa >= other.paisa; }
+};
+
+//======================================================
+// STRUCTURE: LoanOption
+// Purpose: Stores information about a specific home loan option
+//======================================================
+struct LoanOption {
+    string_view category;       // text fields point into the system's arena
+    string_view details;        // and are kept for display only
+    string_view installments;
+    string_view price;
+    string_view downPayment;
+
+    // Parsed once when the table is loaded
+    Money priceValue;
+    Money downPaymentValue;
+    int installmentCount;
+};
+
+//======================================================
+// CLASS: CategoryIndex
+// Purpose: The categories of one loan table, built once per
+//          load. Category names are matched case-insensitively
+//          through a hash of their normalized keys; the rows of
+//          every category sit contiguously in file order, so the
+//          n-th option of a category is a direct lookup.
+//======================================================
+class CategoryIndex {
+private:
+    vector<string_view> names;  // first spelling seen, for display
+    vector<int> offsets;        // rows of category c: rows[offsets[c] .. offsets[c + 1])
+    vector<int> rows;
+    HashIndex byKey;
+
+    CategoryIndex(const CategoryIndex&) = delete;
+    CategoryIndex& operator=(const CategoryIndex&) = delete;
+
+    //======================================================
+    // FUNCTION: normalizeKey
+    // Aim: Trimmed, lowercased (ASCII) category key
+    //======================================================
+    static string normalizeKey(string_view name) {
+        size_t first = name.find_first_not_of(" \t\r\n");
+        if (first == string_view::npos) return "";
+        size_t last = name.find_last_not_of(" \t\r\n");
+        string key(name.substr(first, last - first + 1));
+        for (size_t i = 0; i < key.size(); i++) {
+            if (key[i] >= 'A' && key[i] <= 'Z') key[i] = key[i] + 32;
+        }
+        return key;
+    }
+
+public:
+    CategoryIndex() : offsets(1, 0) {}
+
+    //======================================================
+    // FUNCTION: build
+    // Aim: Indexes options[0..count) by category in O(count)
+    //======================================================
+    void build(const LoanOption* options, int count) {
+        names.clear();
+        byKey.clear();
+        byKey.reserve(16);
+
+        vector<int> categoryOfRow(count);
+        vector<int> sizes;
+        for (int i = 0; i < count; i++) {
+            string key = normalizeKey(options[i].category);
+            int category = byKey.find(key);
+            if (category < 0) {
+                category = (int)names.size();
+                byKey.insert(key, category);
+                names.push_back(options[i].category);
+                sizes.push_back(0);
+            }
+            categoryOfRow[i] = category;
+            sizes[category]++;
+        }
+
+        // Counting sort keeps file order inside each category
+        offsets.assign(names.size() + 1, 0);
+        for (size_t c = 0; c < names.size(); c++) {
+            offsets[c + 1] = offsets[c] + sizes[c];
+        }
+        rows.assign(count, 0);
+        vector<int> next(offsets.begin(), offsets.end() - 1);
+        for (int i = 0; i < count; i++) {
+            rows[next[categoryOfRow[i]]++] = i;
+        }
+    }
+
+    int categoryCount() const { return (int)names.size(); }
+    string_view name(int category) const { return names[category]; }
+    int optionCount(int category) const { return offsets[category + 1] - offsets[category]; }
+
+    //======================================================
+    // FUNCTION: optionRow
+    // Aim: Array row of the option-th (0-based) option of a
+    //      category
+    //======================================================
+    int optionRow(int category, int option) const {
+        return rows[offsets[category] + option];
+    }
+
+    //======================================================
+    // FUNCTION: find
+    // Aim: Category number for a name in any case, or -1
+    //======================================================
+    int find(string_view name) const {
+        return byKey.find(normalizeKey(name));
+    }
+
+    //======================================================
+    // FUNCTION: assign
+    // Aim: Takes a prebuilt index (from a catalog image) over
+    //      rowCount options. The key hash is adopted separately
+    //      through keys(). Returns false if it is inconsistent.
+    //======================================================
+    bool assign(const vector<string_view>& categoryNames, const int32_t* categoryOffsets,
+        const int32_t* categoryRows, int rowCount) {
+        size_t categories = categoryNames.size();
+        if (categoryOffsets[0] != 0 || categoryOffsets[categories] != rowCount) return false;
+        for (size_t c = 0; c < categories; c++) {
+            if (categoryOffsets[c + 1] < categoryOffsets[c]) return false;
+        }
+        for (int i = 0; i < rowCount; i++) {
+            if (categoryRows[i] < 0 || categoryRows[i] >= rowCount) return false;
+        }
+        names = categoryNames;
+        offsets.assign(categoryOffsets, categoryOffsets + categories + 1);
+        rows.assign(categoryRows, categoryRows + rowCount);
+        return true;
+    }
+
+    const int* offsetData() const { return offsets.data(); }
+    const int* rowData() const { return rows.data(); }
+    HashIndex& keys() { return byKey; }
+    const HashIndex& keys() const { return byKey; }
+};
+
+//======================================================
+// CLASS: TextNormalizer
+// Purpose: Brings chat input and utterance inputs to one
+//          spelling before they are matched. Folding lowercases
+//          Latin, Greek and Cyrillic letters, drops Latin accents
+//          and Arabic-script diacritics, unifies the Arabic and
+//          Urdu forms of yeh, kaf and heh, turns Arabic-Indic
+//          digits into ASCII ones and collapses punctuation and
+//          whitespace into single spaces. Synonyms then replace
+//          whole-word phrases through a byte trie, longest phrase
+//          first. Both passes are linear in the input; folded
+//          ASCII input without a synonym comes back as is.
+//======================================================
+class TextNormalizer {
+private:
+    static constexpr int NONE = -1;
+    static constexpr uint32_t DROP = 0xFFFFFFFF;    // folds to nothing
+
+    // ASCII base letters of U+00C0..U+00FF and U+0100..U+017F; '-' if there is none
+    static constexpr char LATIN1_BASE[] = "aaaaaa-ceeeeiiiidnooooo-ouuuuy--aaaaaa-ceeeeiiiidnooooo-ouuuuy-y";
+    static constexpr char LATIN_A_BASE[] =
+        "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii--jjkk-llllllllllnnnnnn---"
+        "oooooo--rrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+    static_assert(sizeof(LATIN1_BASE) == 0x40 + 1, "one letter per code point");
+    static_assert(sizeof(LATIN_A_BASE) == 0x80 + 1, "one letter per code point");
+
+    //======================================================
+    // STRUCTURE: TrieNode
+    // Purpose: A node of the synonym trie. Its edges are
+    //          [firstEdge, firstEdge + edgeCount) of the edge
+    //          arrays; the root's are also in rootNext.
+    //======================================================
+    struct TrieNode {
+        int firstEdge;
+        int edgeCount;
+        int synonym;    // phrase ending here, or NONE
+    };
+
+    vector<TrieNode> nodes;
+    vector<unsigned char> edgeByte;
+    vector<int> edgeTarget;
+    int rootNext[256];
+    string canonicalText;           // replacements, back to back
+    vector<int> canonicalStart;     // synonym s is [canonicalStart[s], canonicalStart[s + 1])
+    size_t expansion;               // longest replacement per phrase byte, rounded up
+
+    TextNormalizer(const TextNormalizer&) = delete;
+    TextNormalizer& operator=(const TextNormalizer&) = delete;
+
+    //======================================================
+    // FUNCTION: decode
+    // Aim: Reads the UTF-8 sequence at text[i] into code and
+    //      returns its length, or 0 if it is malformed
+    //======================================================
+    static size_t decode(string_view text, size_t i, uint32_t& code) {
+        unsigned char lead = text[i];
+        size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 0;
+        if (length == 0 || lead > 0xF4 || i + length > text.size()) return 0;
+        code = lead & (0x7F >> length);
+        for (size_t k = 1; k < length; k++) {
+            unsigned char next = text[i + k];
+            if ((next & 0xC0) != 0x80) return 0;
+            code = (code << 6) | (next & 0x3F);
+        }
+        if ((length == 3 && code < 0x800) || (length == 4 && (code < 0x10000 || code > 0x10FFFF))) return 0;
+        return length;
+    }
+
+    //======================================================
+    // FUNCTION: encode
+    // Aim: Writes code as UTF-8 and returns its length
+    //======================================================
+    static size_t encode(uint32_t code, char* out) {
+        if (code < 0x80) {
+            out[0] = (char)code;
+            return 1;
+        }
+        if (code < 0x800) {
+            out[0] = (char)(0xC0 | (code >> 6));
+            out[1] = (char)(0x80 | (code & 0x3F));
+            return 2;
+        }
+        if (code < 0x10000) {
+            out[0] = (char)(0xE0 | (code >> 12));
+            out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+            out[2] = (char)(0x80 | (code & 0x3F));
+            return 3;
+        }
+        out[0] = (char)(0xF0 | (code >> 18));
+        out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+        out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[3] = (char)(0x80 | (code & 0x3F));
+        return 4;
+    }
+
+    //======================================================
+    // FUNCTION: foldCode
+    // Aim: Folded form of one non-ASCII code point: a code
+    //      point no longer in UTF-8 than it (ASCII for accented
+    //      Latin letters and digits), ' ' for spaces and
+    //      punctuation, or DROP for marks and invisible ones
+    //======================================================
+    static uint32_t foldCode(uint32_t code) {
+        if (code >= 0xA0 && code <= 0xBF) return code == 0xAD ? DROP : ' ';
+        if (code >= 0xC0 && code <= 0xFF) {
+            char base = LATIN1_BASE[code - 0xC0];
+            if (base != '-') return (uint32_t)base;
+            if (code == 0xD7 || code == 0xF7) return ' ';
+            return code < 0xDF ? code + 0x20 : code;
+        }
+        if (code >= 0x100 && code <= 0x17F) {
+            char base = LATIN_A_BASE[code - 0x100];
+            if (base != '-') return (uint32_t)base;
+            return (code & 1) == 0 && code != 0x138 ? code + 1 : code;
+        }
+        if (code >= 0x391 && code <= 0x3A9 && code != 0x3A2) return code + 0x20;    // Greek
+        if (code >= 0x410 && code <= 0x42F) return code + 0x20;                      // Cyrillic
+        if (code >= 0x400 && code <= 0x40F) return code + 0x50;
+        if (code >= 0x600 && code <= 0x6FF) {                                        // Arabic script
+            if ((code >= 0x64B && code <= 0x65F) || code == 0x670 || code == 0x640) return DROP;
+            if (code == 0x64A || code == 0x649) return 0x6CC;     // Urdu yeh
+            if (code == 0x643) return 0x6A9;                       // Urdu kaf
+            if (code == 0x647) return 0x6C1;                       // Urdu heh
+            if (code >= 0x660 && code <= 0x669) return '0' + (code - 0x660);
+            if (code >= 0x6F0 && code <= 0x6F9) return '0' + (code - 0x6F0);
+            if (code == 0x60C || code == 0x61B || code == 0x61F || code == 0x6D4 || (code >= 0x66A && code <= 0x66D)) return ' ';
+            return code;
+        }
+        if ((code >= 0x200B && code <= 0x200F) || code == 0x2060 || code == 0xFEFF) return DROP;
+        if (code == 0x2018 || code == 0x2019) return '\'';
+        if ((code >= 0x2000 && code <= 0x206F) || (code >= 0x3000 && code <= 0x3002)) return ' ';
+        if (code >= 0xFF01 && code <= 0xFF5E) return code - 0xFEE0;                 // fullwidth ASCII
+        return code;
+    }
+
+    //======================================================
+    // FUNCTION: fold
+    // Aim: Writes the folded text to out, which must hold
+    //      text.size() bytes, and returns its length.
+    //      Apostrophes join their neighbours ("what's" is
+    //      "whats"); bytes that are not UTF-8 are kept. Never
+    //      writes past what it has read, so out may be text.
+    //======================================================
+    static size_t fold(string_view text, char* out) {
+        size_t length = 0;
+        bool space = false;     // a separator waits for the next word
+        size_t i = 0;
+        while (i < text.size()) {
+            uint32_t code = (unsigned char)text[i];
+            size_t bytes = 1;
+            if (code >= 0x80) {
+                bytes = decode(text, i, code);
+                if (bytes == 0) {
+                    bytes = 1;      // not UTF-8, kept as it is
+                    code = (unsigned char)text[i];
+                }
+                else {
+                    code = foldCode(code);
+                }
+            }
+            if (code >= 'A' && code <= 'Z') code += 0x20;
+            bool word = (code >= 'a' && code <= 'z') || (code >= '0' && code <= '9') || (code >= 0x80 && code != DROP);
+            if (word) {
+                if (space) out[length++] = ' ';
+                space = false;
+                if (bytes == 1 && code >= 0x80) out[length++] = text[i];
+                else length += encode(code, out + length);
+            }
+            else if (code != DROP && code != '\'') {
+                space = length > 0;
+            }
+            i += bytes;
+        }
+        return length;
+    }
+
+    //======================================================
+    // FUNCTION: child
+    // Aim: Node reached from node over byte, or NONE
+    //======================================================
+    int child(int node, unsigned char byte) const {
+        if (node == 0) return rootNext[byte];
+        const TrieNode& parent = nodes[node];
+        for (int e = parent.firstEdge; e < parent.firstEdge + parent.edgeCount; e++) {
+            if (edgeByte[e] == byte) return edgeTarget[e];
+            if (edgeByte[e] > byte) break;
+        }
+        return NONE;
+    }
+
+    //======================================================
+    // FUNCTION: longestPhrase
+    // Aim: The longest synonym phrase that starts at
+    //      text[start] and ends at a word boundary, or NONE;
+    //      end is set to where it ends
+    //======================================================
+    int longestPhrase(string_view text, size_t start, size_t& end) const {
+        int found = NONE;
+        int node = 0;
+        for (size_t i = start; i < text.size(); i++) {
+            node = child(node, (unsigned char)text[i]);
+            if (node == NONE) break;
+            if (nodes[node].synonym != NONE && (i + 1 == text.size() || text[i + 1] == ' ')) {
+                found = nodes[node].synonym;
+                end = i + 1;
+            }
+        }
+        return found;
+    }
+
+public:
+    //======================================================
+    // STRUCTURE: Synonym
+    // Purpose: One phrase and the text it is replaced with
+    //======================================================
+    struct Synonym {
+        string_view phrase;
+        string_view canonical;
+    };
+
+    TextNormalizer() {
+        build(string_view());
+    }
+
+    //======================================================
+    // FUNCTION: isFolded
+    // Aim: True if folding would not change text: lowercase
+    //      ASCII letters and digits in words split by single
+    //      spaces
+    //======================================================
+    static constexpr bool isFolded(string_view text) {
+        bool afterSpace = true;
+        for (size_t i = 0; i < text.size(); i++) {
+            char c = text[i];
+            if (c == ' ') {
+                if (afterSpace) return false;
+                afterSpace = true;
+            }
+            else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+                afterSpace = false;
+            }
+            else {
+                return false;
+            }
+        }
+        return text.empty() || !afterSpace;
+    }
+
+
+    //======================================================
+    // FUNCTION: build
+    // Aim: Compiles "phrase#canonical" lines, then the
+    //      defaults, into the synonym trie. Both sides are
+    //      folded first; the first entry of a phrase wins.
+    //      Replaces any earlier table; returns the number of
+    //      synonyms.
+    //======================================================
+    int build(string_view text, const Synonym* defaults = nullptr, int defaultCount = 0) {
+        nodes.assign(1, TrieNode{ 0, 0, NONE });
+        edgeByte.clear();
+        edgeTarget.clear();
+        fill(rootNext, rootNext + 256, NONE);
+        canonicalText.clear();
+        canonicalStart.assign(1, 0);
+        expansion = 1;
+
+        vector<pair<string, string>> entries;
+        while (!text.empty()) {
+            string_view line = nextField(text, '\n');
+            string_view canonical = line;
+            string_view phrase = nextField(canonical, '#');
+            if (phrase.size() == line.size()) continue;     // no '#'
+            entries.emplace_back(string(phrase), string(canonical));
+        }
+        for (int d = 0; d < defaultCount; d++) {
+            entries.emplace_back(string(defaults[d].phrase), string(defaults[d].canonical));
+        }
+        for (pair<string, string>& entry : entries) {
+            entry.first.resize(fold(entry.first, &entry.first[0]));
+            entry.second.resize(fold(entry.second, &entry.second[0]));
+        }
+
+        // Grow the trie with unsorted edge lists, then lay it out
+        vector<vector<pair<unsigned char, int>>> children(1);
+        for (const pair<string, string>& entry : entries) {
+            if (entry.first.empty() || entry.second.empty()) continue;
+            int node = 0;
+            for (unsigned char byte : entry.first) {
+                int next = NONE;
+                for (const pair<unsigned char, int>& edge : children[node]) {
+                    if (edge.first == byte) next = edge.second;
+                }
+                if (next == NONE) {
+                    next = (int)nodes.size();
+                    children[node].emplace_back(byte, next);
+                    nodes.push_back({ 0, 0, NONE });
+                    children.emplace_back();
+                }
+                node = next;
+            }
+            if (nodes[node].synonym != NONE) continue;
+            nodes[node].synonym = (int)canonicalStart.size() - 1;
+            canonicalText += entry.second;
+            canonicalStart.push_back((int)canonicalText.size());
+            expansion = max(expansion, (entry.second.size() + entry.first.size() - 1) / entry.first.size());
+        }
+
+        for (int n = 0; n < (int)nodes.size(); n++) {
+            sort(children[n].begin(), children[n].end());
+            nodes[n].firstEdge = (int)edgeByte.size();
+            nodes[n].edgeCount = (int)children[n].size();
+            for (const pair<unsigned char, int>& edge : children[n]) {
+                edgeByte.push_back(edge.first);
+                edgeTarget.push_back(edge.second);
+                if (n == 0) rootNext[edge.first] = edge.second;
+            }
+        }
+        return synonymCount();
+    }
+
+    //======================================================
+    // FUNCTION: synonymCount
+    // Aim: Number of phrases in the trie
+    //======================================================
+    int synonymCount() const {
+        return (int)canonicalStart.size() - 1;
+    }
+
+    //======================================================
+    // FUNCTION: apply
+    // Aim: Normalized view of text. Copies go to arena (any
+    //      class with allocate(size)); text that is already
+    //      normal is returned as is, without a copy.
+    //======================================================
+    template <class Arena>
+    string_view apply(string_view text, Arena& arena) const {
+        if (!isFolded(text)) {
+            char* folded = arena.allocate(text.size());
+            text = string_view(folded, fold(text, folded));
+        }
+        if (synonymCount() == 0) return text;
+
+        char* out = nullptr;
+        size_t length = 0;
+        size_t copied = 0;      // text before this is in out
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = 0;
+            int synonym = longestPhrase(text, start, end);
+            if (synonym != NONE) {
+                if (out == nullptr) out = arena.allocate(text.size() * expansion);
+                memcpy(out + length, text.data() + copied, start - copied);
+                length += start - copied;
+                size_t canonicalLength = canonicalStart[synonym + 1] - canonicalStart[synonym];
+                memcpy(out + length, canonicalText.data() + canonicalStart[synonym], canonicalLength);
+                length += canonicalLength;
+                copied = start = end;
+            }
+            else {
+                start = text.find(' ', start);
+                if (start == string_view::npos) start = text.size();
+            }
+            start++;
+        }
+        if (out == nullptr) return text;
+        memcpy(out + length, text.data() + copied, text.size() - copied);
+        length += text.size() - copied;
+        return string_view(out, length);
+    }
+};
+
+//======================================================
+// CLASS: IntentMatcher
+// Purpose: Fallback matching for inputs that are not an exact
+//          utterance. Utterance inputs are split into tokens
+//          and kept in an inverted index scored with BM25;
+//          unknown query tokens are corrected for typos through
+//          a SymSpell-style dictionary of deletions. The best
+//          utterance is returned only if its confidence, a
+//          Dice-style overlap of BM25 mass between query and
+//          utterance, reaches MATCH_THRESHOLD.
+//======================================================
+class IntentMatcher {
+private:
+    static constexpr float K1 = 1.2f;
+    static constexpr float B = 0.75f;
+    static constexpr int MAX_DELETES = 2;       // edits indexed per term
+    static constexpr int MAX_TOKEN = 32;        // longer tokens are not corrected
+    static constexpr int MAX_QUERY_TERMS = 32;  // distinct terms used from one input
+
+    int docCount;
+    HashIndex terms;                // token -> term id
+    vector<string_view> termText;   // views into the utterance inputs
+    vector<float> idf;
+    float maxIdf;
+
+    // Inverted index: postings of term t are [termStart[t], termStart[t + 1])
+    vector<int> termStart;
+    vector<int> postingDoc;
+    vector<float> postingWeight;    // BM25 weight of the term in that document
+
+    // Forward index: terms of document d are [docStart[d], docStart[d + 1])
+    vector<int> docStart;
+    vector<int> docTerm;
+    vector<float> docWeight;
+    vector<float> selfScore;        // sum of the document's own weights
+
+    // Deletion dictionary: terms reachable from deletion key k
+    HashIndex deletions;
+    vector<int> deletionStart;
+    vector<int> deletionTerm;
+
+    IntentMatcher(const IntentMatcher&) = delete;
+    IntentMatcher& operator=(const IntentMatcher&) = delete;
+
+    //======================================================
+    // STRUCTURE: QueryTerm
+    // Purpose: A query token resolved to an indexed term, with
+    //          its similarity (1 for exact, less for typos)
+    //======================================================
+    struct QueryTerm {
+        int term;
+        float similarity;
+    };
+
+    //======================================================
+    // FUNCTION: isTokenChar
+    // Aim: Letters, digits and any UTF-8 byte are part of a
+    //      token; everything else separates tokens
+    //======================================================
+    static bool isTokenChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (unsigned char)c >= 0x80;
+    }
+
+    //======================================================
+    // FUNCTION: nextToken
+    // Aim: Splits the next token off lowercased text; returns
+    //      an empty view when there are none left
+    //======================================================
+    static string_view nextToken(string_view& text) {
+        size_t start = 0;
+        while (start < text.size() && !isTokenChar(text[start])) start++;
+        size_t end = start;
+        while (end < text.size() && isTokenChar(text[end])) end++;
+        string_view token = text.substr(start, end - start);
+        text.remove_prefix(end);
+        return token;
+    }
+
+    //======================================================
+    // FUNCTION: allowedEdits
+    // Aim: Typos tolerated in a query token of this length.
+    //      Numbers are never corrected.
+    //======================================================
+    static int allowedEdits(string_view token) {
+        for (size_t i = 0; i < token.size(); i++) {
+            if (token[i] >= '0' && token[i] <= '9') return 0;
+        }
+        if (token.size() < 3 || token.size() > MAX_TOKEN) return 0;
+        return token.size() < 5 ? 1 : 2;
+    }
+
+    //======================================================
+    // FUNCTION: editDistance
+    // Aim: Optimal string alignment distance (insert, delete,
+    //      substitute, swap neighbours), or limit + 1 once it
+    //      is certain to exceed limit
+    //======================================================
+    static int editDistance(string_view a, string_view b, int limit) {
+        int lengthGap = (int)a.size() - (int)b.size();
+        if (lengthGap > limit || -lengthGap > limit) return limit + 1;
+        if (a.size() > MAX_TOKEN || b.size() > MAX_TOKEN) return limit + 1;
+
+        int rows[3][MAX_TOKEN + 1];
+        int* before = rows[0];
+        int* previous = rows[1];
+        int* current = rows[2];
+        for (size_t j = 0; j <= b.size(); j++) previous[j] = (int)j;
+
+        for (size_t i = 1; i <= a.size(); i++) {
+            current[0] = (int)i;
+            int rowBest = current[0];
+            for (size_t j = 1; j <= b.size(); j++) {
+                int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+                int best = min(min(previous[j] + 1, current[j - 1] + 1), previous[j - 1] + cost);
+                if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]) {
+                    best = min(best, before[j - 2] + 1);
+                }
+                current[j] = best;
+                rowBest = min(rowBest, best);
+            }
+            if (rowBest > limit) return limit + 1;
+            int* recycled = before;
+            before = previous;
+            previous = current;
+            current = recycled;
+        }
+        return previous[b.size()];
+    }
+
+    //======================================================
+    // FUNCTION: forEachDeletion
+    // Aim: Calls visit with every string reachable from word
+    //      by deleting 1..edits characters, built on the stack.
+    //      A string may be visited more than once.
+    //======================================================
+    template <class Visit>
+    static void forEachDeletion(const char* word, size_t length, int edits, Visit& visit) {
+        if (edits == 0 || length <= 1) return;
+        char shorter[MAX_TOKEN];
+        for (size_t i = 0; i < length; i++) {
+            if (i > 0 && word[i] == word[i - 1]) continue;     // same as deleting word[i - 1]
+            memcpy(shorter, word, i);
+            memcpy(shorter + i, word + i + 1, length - i - 1);
+            visit(string_view(shorter, length - 1));
+            forEachDeletion(shorter, length - 1, edits - 1, visit);
+        }
+    }
+
+    //======================================================
+    // FUNCTION: correct
+    // Aim: Closest indexed term to an unknown token, or -1.
+    //      Ties go to the more common term.
+    //======================================================
+    int correct(string_view token, int& distance) const {
+        int edits = allowedEdits(token);
+        if (edits == 0 || deletions.size() == 0) return -1;
+
+        int best = -1;
+        distance = edits + 1;
+        auto visit = [&](string_view key) {
+            int group = deletions.find(key);
+            if (group < 0) return;
+            for (int i = deletionStart[group]; i < deletionStart[group + 1]; i++) {
+                int term = deletionTerm[i];
+                int d = editDistance(token, termText[term], distance);
+                int df = termStart[term + 1] - termStart[term];
+                if (d < distance || (d == distance && best >= 0 && term != best &&
+                    df > termStart[best + 1] - termStart[best])) {
+                    distance = d;
+                    best = term;
+                }
+            }
+        };
+        visit(token);
+        forEachDeletion(token.data(), token.size(), edits, visit);
+        return distance <= edits ? best : -1;
+    }
+
+public:
+    static constexpr float MATCH_THRESHOLD = 0.5f;
+
+    IntentMatcher() : docCount(0), maxIdf(0) {}
+
+    //======================================================
+    // FUNCTION: build
+    // Aim: Indexes the (lowercased) inputs of count utterances
+    //======================================================
+    void build(const Utterance* utterances, int count) {
+        docCount = count;
+        terms.clear();
+        termText.clear();
+        deletions.clear();
+
+        // Tokenize every input once: term ids per document
+        vector<int> termsOfDoc;
+        docStart.assign(1, 0);
+        vector<int> df;
+        for (int d = 0; d < count; d++) {
+            string_view text = utterances[d].input;
+            int first = (int)termsOfDoc.size();
+            for (string_view token = nextToken(text); !token.empty(); token = nextToken(text)) {
+                int term = terms.find(token);
+                if (term < 0) {
+                    term = (int)termText.size();
+                    terms.insert(token, term);
+                    termText.push_back(token);
+                    df.push_back(0);
+                }
+                bool repeated = false;
+                for (int k = first; k < (int)termsOfDoc.size() && !repeated; k++) {
+                    repeated = termsOfDoc[k] == term;
+                }
+                if (!repeated) df[term]++;
+                termsOfDoc.push_back(term);
+            }
+            docStart.push_back((int)termsOfDoc.size());
+        }
+
+        int termCount = (int)termText.size();
+        double averageLength = count > 0 ? (double)termsOfDoc.size() / count : 0;
+        idf.assign(termCount, 0);
+        maxIdf = (float)log(1.0 + (count + 0.5) / 0.5);
+        for (int t = 0; t < termCount; t++) {
+            idf[t] = (float)log(1.0 + (count - df[t] + 0.5) / (df[t] + 0.5));
+        }
+
+        // Forward index with BM25 weights, one entry per distinct term
+        vector<int> forwardStart(1, 0);
+        docTerm.clear();
+        docWeight.clear();
+        selfScore.assign(count, 0);
+        for (int d = 0; d < count; d++) {
+            int length = docStart[d + 1] - docStart[d];
+            double norm = K1 * (1 - B + B * (averageLength > 0 ? length / averageLength : 1));
+            for (int k = docStart[d]; k < docStart[d + 1]; k++) {
+                int term = termsOfDoc[k];
+                bool repeated = false;
+                for (int j = docStart[d]; j < k && !repeated; j++) repeated = termsOfDoc[j] == term;
+                if (repeated) continue;
+
+                int tf = 0;
+                for (int j = k; j < docStart[d + 1]; j++) tf += termsOfDoc[j] == term;
+                float weight = (float)(idf[term] * tf * (K1 + 1) / (tf + norm));
+                docTerm.push_back(term);
+                docWeight.push_back(weight);
+                selfScore[d] += weight;
+            }
+            forwardStart.push_back((int)docTerm.size());
+        }
+        docStart.swap(forwardStart);
+
+        // Inverted index by counting sort of the forward index
+        termStart.assign(termCount + 1, 0);
+        for (size_t i = 0; i < docTerm.size(); i++) termStart[docTerm[i] + 1]++;
+        for (int t = 0; t < termCount; t++) termStart[t + 1] += termStart[t];
+        postingDoc.assign(docTerm.size(), 0);
+        postingWeight.assign(docTerm.size(), 0);
+        vector<int> next(termStart.begin(), termStart.end() - 1);
+        for (int d = 0; d < count; d++) {
+            for (int k = docStart[d]; k < docStart[d + 1]; k++) {
+                int slot = next[docTerm[k]]++;
+                postingDoc[slot] = d;
+                postingWeight[slot] = docWeight[k];
+            }
+        }
+
+        // Deletion dictionary: each term and its deletions point back at it
+        vector<pair<int, int>> entries;     // (deletion key, term)
+        vector<int> lastTerm;               // per key, to drop repeated deletions
+        for (int t = 0; t < termCount; t++) {
+            if (termText[t].size() > MAX_TOKEN) continue;
+            auto visit = [&](string_view deleted) {
+                int key = deletions.find(deleted);
+                if (key < 0) {
+                    key = (int)deletions.size();
+                    deletions.insert(deleted, key);
+                    lastTerm.push_back(-1);
+                }
+                if (lastTerm[key] == t) return;
+                lastTerm[key] = t;
+                entries.push_back(make_pair(key, t));
+            };
+            visit(termText[t]);
+            forEachDeletion(termText[t].data(), termText[t].size(), MAX_DELETES, visit);
+        }
+        deletionStart.assign(deletions.size() + 1, 0);
+        for (size_t i = 0; i < entries.size(); i++) deletionStart[entries[i].first + 1]++;
+        for (size_t k = 0; k < deletions.size(); k++) deletionStart[k + 1] += deletionStart[k];
+        deletionTerm.assign(entries.size(), 0);
+        next.assign(deletionStart.begin(), deletionStart.end() - 1);
+        for (size_t i = 0; i < entries.size(); i++) {
+            deletionTerm[next[entries[i].first]++] = entries[i].second;
+        }
+    }
+
+    //======================================================
+    // FUNCTION: match
+    // Aim: Index of the best utterance for a lowercased input,
+    //      or -1 if none is confident enough
+    //======================================================
+    int match(string_view lowerInput) const {
+        if (docCount == 0) return -1;
+
+        // Resolve query tokens to terms; unknown ones only add to the query's mass
+        QueryTerm query[MAX_QUERY_TERMS];
+        size_t queryCount = 0;
+        float queryMass = 0;
+        for (string_view token = nextToken(lowerInput); !token.empty(); token = nextToken(lowerInput)) {
+            int term = terms.find(token);
+            float similarity = 1;
+            if (term < 0) {
+                int distance = 0;
+                term = correct(token, distance);
+                similarity = 1 - (float)distance / (float)max(token.size(), term >= 0 ? termText[term].size() : 1);
+            }
+            if (term < 0) {
+                queryMass += maxIdf;
+                continue;
+            }
+            queryMass += idf[term];
+
+            bool repeated = false;
+            for (size_t k = 0; k < queryCount && !repeated; k++) {
+                if (query[k].term == term) {
+                    repeated = true;
+                    query[k].similarity = max(query[k].similarity, similarity);
+                }
+            }
+            if (!repeated && queryCount < MAX_QUERY_TERMS) query[queryCount++] = QueryTerm{ term, similarity };
+        }
+        if (queryCount == 0) return -1;
+
+        // Rare terms first. Postings of common terms are only read
+        // when every query term is common; otherwise their weight is
+        // added from the forward index of the candidates.
+        sort(query, query + queryCount, [this](const QueryTerm& a, const QueryTerm& b) {
+            return termStart[a.term + 1] - termStart[a.term] < termStart[b.term + 1] - termStart[b.term];
+        });
+        int common = max(64, docCount / 16);
+        size_t scanned = 0;
+        while (scanned < queryCount && termStart[query[scanned].term + 1] - termStart[query[scanned].term] <= common) {
+            scanned++;
+        }
+        if (scanned == 0) scanned = queryCount;
+
+        thread_local vector<float> score;
+        thread_local vector<int> touched;
+        if ((int)score.size() < docCount) score.assign(docCount, 0);
+        touched.clear();
+        for (size_t q = 0; q < scanned; q++) {
+            const QueryTerm& term = query[q];
+            for (int i = termStart[term.term]; i < termStart[term.term + 1]; i++) {
+                int d = postingDoc[i];
+                if (score[d] == 0) touched.push_back(d);
+                score[d] += term.similarity * postingWeight[i];
+            }
+        }
+
+        int best = -1;
+        float bestConfidence = 0;
+        for (size_t i = 0; i < touched.size(); i++) {
+            int d = touched[i];
+            float total = score[d];
+            score[d] = 0;
+            for (size_t q = scanned; q < queryCount; q++) {
+                for (int k = docStart[d]; k < docStart[d + 1]; k++) {
+                    if (docTerm[k] == query[q].term) total += query[q].similarity * docWeight[k];
+                }
+            }
+            float confidence = 2 * total / (selfScore[d] + queryMass);
+            if (confidence > bestConfidence || (confidence == bestConfidence && d < best)) {
+                bestConfidence = confidence;
+                best = d;
+            }
+        }
+        return bestConfidence >= MATCH_THRESHOLD ? best : -1;
+    }
+};
+
+//======================================================
+// AMORTIZATION ENGINE
+// Annuity schedules with a configurable annual rate (percent).
+// A rate of 0 gives the plain (price - down payment) / months
+// split. Schedules are computed apart from any rendering.
+//======================================================
+
+//======================================================
+// FUNCTION: monthlyPayment
+// Aim: Annuity payment M = P*r*g / (g - 1), g = (1 + r)^n,
+//      r = annual rate / 1200. Falls back to P / n at r = 0.
+//======================================================
+double monthlyPayment(double principal, double annualRate, int months) {
+    if (months <= 0) return 0;
+    double r = annualRate / 1200.0;
+    if (r <= 0) return principal / months;
+    double growth = pow(1.0 + r, months);
+    return principal * r * growth / (growth - 1.0);
+}
+
+//======================================================
+// STRUCTURE: AmortizationRow
+// Purpose: One month of a repayment schedule
+//======================================================
+struct AmortizationRow {
+    int month;
+    Money payment;
+    Money interest;
+    Money principal;
+    Money balance;      // remaining after this payment
+};
+
+//======================================================
+// CLASS: ScheduleCursor
+// Purpose: Lazy repayment schedule. Rows are produced one at
+//          a time from the closed form, so a 360-month plan is
+//          never held in memory, rows do not accumulate
+//          rounding from the ones before them, and a page can
+//          start anywhere with seek().
+//======================================================
+static const int MAX_INSTALLMENTS = 360;
+
+class ScheduleCursor {
+private:
+    Money principal;
+    double annualRate;
+    Money payment;          // every month but the last
+    Money lastPayment;      // payment plus the rounding remainder
+    Money previous;         // balance before the next row
+    int months;
+    int month;              // rows produced so far
+
+    //======================================================
+    // FUNCTION: balanceAfter
+    // Aim: Closed-form balance after k payments of the rounded
+    //      payment, B(k) = P*g^k - M*(g^k - 1)/r (P - M*k at
+    //      r = 0), rounded to paisa. Unclamped, so B(months) is
+    //      what the rounded payments leave over (or overpay).
+    //======================================================
+    Money balanceAfter(int k) const {
+        double r = annualRate / 1200.0;
+        return balanceAfter(k, r <= 0 ? 1.0 : pow(1.0 + r, k));
+    }
+
+    Money balanceAfter(int k, double growth) const {
+        double r = annualRate / 1200.0;
+        if (r <= 0) return principal - payment * k;
+        return Money::round((double)principal.paisa * growth - (double)payment.paisa * (growth - 1.0) / r);
+    }
+
+public:
+    //======================================================
+    // FUNCTION: termGrowth
+    // Aim: g = (1 + r)^months of a term; 1 at r = 0
+    //======================================================
+    static double termGrowth(double annualRate, int months) {
+        double r = annualRate / 1200.0;
+        return r <= 0 || months <= 0 ? 1.0 : pow(1.0 + r, months);
+    }
+
+    ScheduleCursor(Money loanAmount, double rate, int termMonths)
+        : ScheduleCursor(loanAmount, rate, termMonths, termGrowth(rate, termMonths)) {}
+
+    // With g from termGrowth: many loans of one term and rate
+    // share it, and payments come out the same as above
+    ScheduleCursor(Money loanAmount, double rate, int termMonths, double growth)
+        : principal(loanAmount), annualRate(rate), previous(loanAmount),
+          months(termMonths > 0 ? termMonths : 0), month(0) {
+        double r = annualRate / 1200.0;
+        double exact = months <= 0 ? 0 : r <= 0 ? (double)principal.paisa / months
+            : (double)principal.paisa * r * growth / (growth - 1.0);
+        payment = Money::round(exact);
+        lastPayment = months > 0 ? payment + balanceAfter(months, growth) : Money();
+        if (lastPayment.paisa < 0) {
+            // Tiny loans: rounding up overpaid by more than a whole
+            // installment, so round down and let the last row top up
+            payment = Money::round(floor(exact));
+            lastPayment = payment + balanceAfter(months, growth);
+        }
+    }
+
+    Money monthly() const { return payment; }
+    int term() const { return months; }
+    int position() const { return month; }
+    bool done() const { return month >= months; }
+
+    //======================================================
+    // FUNCTION: totalPaid
+    // Aim: Sum of all payments, the last one included
+    //======================================================
+    Money totalPaid() const {
+        return months > 0 ? payment * (months - 1) + lastPayment : Money();
+    }
+
+    //======================================================
+    // FUNCTION: seek
+    // Aim: Makes the next row month rowsBefore + 1
+    //======================================================
+    void seek(int rowsBefore) {
+        month = rowsBefore < 0 ? 0 : rowsBefore > months ? months : rowsBefore;
+        previous = balanceAfter(month);
+    }
+
+    //======================================================
+    // FUNCTION: next
+    // Aim: Fills row with the next month; false at the end.
+    //      Principal is the drop in balance and interest the
+    //      rest of the payment, so every row adds up exactly.
+    //      The last row pays off what is left.
+    //======================================================
+    bool next(AmortizationRow& row) {
+        if (month >= months) return false;
+        month++;
+        bool last = month == months;
+        Money balance = last ? Money() : balanceAfter(month);
+        row.month = month;
+        row.payment = last ? lastPayment : payment;
+        row.principal = previous - balance;
+        row.interest = row.payment - row.principal;
+        row.balance = balance;
+        previous = balance;
+        return true;
+    }
+};
+
+//======================================================
+// ENUM: PlanFormat
+// Purpose: Export formats of an installment plan
+//======================================================
+enum PlanFormat {
+    PLAN_CSV,
+    PLAN_JSON
+};
+
+static const int PLAN_CHUNK_ROWS = 60;      // rows per flush / console page
+
+//======================================================
+// FUNCTION: appendPaisa
+// Aim: Appends an amount as plain rupees with two decimals
+//      ("-1234.50"), the form CSV and JSON exports use
+//======================================================
+void appendPaisa(string& text, Money value) {
+    uint64_t magnitude = value.paisa < 0 ? 0 - (uint64_t)value.paisa : (uint64_t)value.paisa;
+    char digits[32];
+    char* end = digits;
+    if (value.paisa < 0) *end++ = '-';
+    end = to_chars(end, digits + sizeof(digits), magnitude / 100).ptr;
+    *end++ = '.';
+    *end++ = (char)('0' + magnitude % 100 / 10);
+    *end++ = (char)('0' + magnitude % 10);
+    text.append(digits, end - digits);
+}
+
+//======================================================
+// FUNCTION: appendCsvField
+// Aim: Appends text as one CSV field, quoted if it holds a
+//      comma, quote or line break
+//======================================================
+void appendCsvField(string& text, string_view field) {
+    if (field.find_first_of(",\"\r\n") == string_view::npos) {
+        text += field;
+        return;
+    }
+    text += '"';
+    for (char c : field) {
+        if (c == '"') text += '"';
+        text += c;
+    }
+    text += '"';
+}
+
+//======================================================
+// CLASS: PlanWriter
+// Purpose: Streams an installment plan to a file as CSV or
+//          JSON. Rows are collected in a buffer that is
+//          written once per chunk of rows, never per line.
+//======================================================
+class PlanWriter {
+private:
+    FILE* stream;
+    PlanFormat format;
+    string buffer;
+    int chunkRows;
+    int pendingRows;        // rows in buffer since the last flush
+
+    PlanWriter(const PlanWriter&) = delete;
+    PlanWriter& operator=(const PlanWriter&) = delete;
+
+    void appendNumber(double value) {
+        if (fabs(value) < 0.005) value = 0;     // no "-0.00" from rounding noise
+        char text[48];
+        int length = snprintf(text, sizeof(text), "%.2f", value);
+        if (length > 0 && length < (int)sizeof(text)) buffer.append(text, length);
+    }
+
+    void appendNumber(Money value) {
+        appendPaisa(buffer, value);
+    }
+
+    void appendJsonString(string_view text) {
+        buffer += '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+                buffer += c;
+            }
+            else if ((unsigned char)c < 0x20) {
+                char escaped[8];
+                buffer.append(escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", c));
+            }
+            else {
+                buffer += c;
+            }
+        }
+        buffer += '"';
+    }
+
+public:
+    size_t flushes;
+
+    PlanWriter(FILE* target, PlanFormat planFormat, int rowsPerChunk = PLAN_CHUNK_ROWS)
+        : stream(target), format(planFormat), chunkRows(rowsPerChunk > 0 ? rowsPerChunk : 1),
+          pendingRows(0), flushes(0) {}
+
+    ~PlanWriter() {
+        flush();
+    }
+
+    //======================================================
+    // FUNCTION: begin
+    // Aim: Writes the loan summary (JSON) or header row (CSV)
+    //======================================================
+    void begin(const LoanOption& loan, string_view loanType, double annualRate, const ScheduleCursor& cursor) {
+        if (format == PLAN_CSV) {
+            buffer += "month,payment,interest,principal,balance\n";
+            return;
+        }
+        buffer += "{\"loanType\":";
+        appendJsonString(loanType);
+        buffer += ",\"category\":";
+        appendJsonString(loan.category);
+        buffer += ",\"details\":";
+        appendJsonString(loan.details);
+        buffer += ",\"price\":";
+        appendNumber(loan.priceValue);
+        buffer += ",\"downPayment\":";
+        appendNumber(loan.downPaymentValue);
+        buffer += ",\"annualRate\":";
+        appendNumber(annualRate);
+        buffer += ",\"months\":";
+        buffer += to_string(cursor.term());
+        buffer += ",\"monthlyPayment\":";
+        appendNumber(cursor.monthly());
+        buffer += ",\"rows\":[";
+    }
+
+    //======================================================
+    // FUNCTION: row
+    // Aim: Appends one month; flushes every chunkRows rows
+    //======================================================
+    void row(const AmortizationRow& month) {
+        if (format == PLAN_JSON) {
+            if (month.month > 1) buffer += ',';
+            buffer += "\n{\"month\":";
+            buffer += to_string(month.month);
+            buffer += ",\"payment\":";
+            appendNumber(month.payment);
+            buffer += ",\"interest\":";
+            appendNumber(month.interest);
+            buffer += ",\"principal\":";
+            appendNumber(month.principal);
+            buffer += ",\"balance\":";
+            appendNumber(month.balance);
+            buffer += '}';
+        }
+        else {
+            buffer += to_string(month.month);
+            buffer += ',';
+            appendNumber(month.payment);
+            buffer += ',';
+            appendNumber(month.interest);
+            buffer += ',';
+            appendNumber(month.principal);
+            buffer += ',';
+            appendNumber(month.balance);
+            buffer += '\n';
+        }
+        if (++pendingRows >= chunkRows) flush();
+    }
+
+    //======================================================
+    // FUNCTION: end
+    // Aim: Closes the document and flushes the last chunk
+    //======================================================
+    void end(Money totalPaid) {
+        if (format == PLAN_JSON) {
+            buffer += "\n],\"totalPaid\":";
+            appendNumber(totalPaid);
+            buffer += "}\n";
+        }
+        flush();
+    }
+
+    void flush() {
+        if (buffer.empty()) return;
+        fwrite(buffer.data(), 1, buffer.size(), stream);
+        fflush(stream);
+        buffer.clear();
+        pendingRows = 0;
+        flushes++;
+    }
+};
+
+//======================================================
+// ENUM: BatchFormat
+// Purpose: How --batch-plans writes its schedules
+//======================================================
+enum BatchFormat {
+    BATCH_CSV,          // one CSV stream, a line per month
+    BATCH_COLUMNS       // a directory with one binary file per column
+};
+
+static const int BATCH_TERMS = 120;             // default last term of a batch
+static const int BATCH_TASK_ROWS = 16384;       // schedule rows one task computes per round
+static const int BATCH_TASKS_PER_THREAD = 4;
+static const int BATCH_AMOUNTS = 4;             // payment, interest, principal, balance
+
+//======================================================
+// STRUCTURE: BatchBlock
+// Purpose: The schedules of a run of options for every term of
+//          a batch: CSV lines, or column values plus the lines
+//          of plans.csv. Blocks are reused from round to round.
+//======================================================
+struct BatchBlock {
+    string text;
+    vector<int32_t> plan;
+    vector<int16_t> month;
+    vector<int64_t> amounts[BATCH_AMOUNTS];
+    uint64_t rows = 0;
+
+    void clear() {
+        text.clear();
+        plan.clear();
+        month.clear();
+        for (int a = 0; a < BATCH_AMOUNTS; a++) amounts[a].clear();
+        rows = 0;
+    }
+};
+
+//======================================================
+// FUNCTION: fillBatchBlock
+// Aim: Appends the schedules of one option for terms
+//      firstTerm..lastTerm to block. prefix ("product,
+//      category,option,") starts every CSV and plans.csv line;
+//      the option's plans are numbered from firstPlan.
+//======================================================
+void fillBatchBlock(const LoanOption& loan, string_view prefix, int firstTerm, int lastTerm, double annualRate,
+    BatchFormat format, int32_t firstPlan, BatchBlock& block) {
+    char number[16];
+    char termText[16];
+    AmortizationRow row;
+    for (int months = firstTerm; months <= lastTerm; months++) {
+        ScheduleCursor cursor(loan.priceValue - loan.downPaymentValue, annualRate, months);
+        string_view term(termText, to_chars(termText, termText + sizeof(termText), months).ptr - termText);
+        int32_t plan = firstPlan + (months - firstTerm);
+        if (format == BATCH_COLUMNS) {
+            block.text.append(number, to_chars(number, number + sizeof(number), plan).ptr - number);
+            block.text += ',';
+            block.text += prefix;
+            block.text += term;
+            block.text += ',';
+            appendPaisa(block.text, cursor.monthly());
+            block.text += ',';
+            appendPaisa(block.text, loan.downPaymentValue + cursor.totalPaid());
+            block.text += '\n';
+        }
+        while (cursor.next(row)) {
+            if (format == BATCH_COLUMNS) {
+                block.plan.push_back(plan);
+                block.month.push_back((int16_t)row.month);
+                block.amounts[0].push_back(row.payment.paisa);
+                block.amounts[1].push_back(row.interest.paisa);
+                block.amounts[2].push_back(row.principal.paisa);
+                block.amounts[3].push_back(row.balance.paisa);
+            }
+            else {
+                block.text += prefix;
+                block.text += term;
+                block.text += ',';
+                block.text.append(number, to_chars(number, number + sizeof(number), row.month).ptr - number);
+                block.text += ',';
+                appendPaisa(block.text, row.payment);
+                block.text += ',';
+                appendPaisa(block.text, row.interest);
+                block.text += ',';
+                appendPaisa(block.text, row.principal);
+                block.text += ',';
+                appendPaisa(block.text, row.balance);
+                block.text += '\n';
+            }
+            block.rows++;
+        }
+    }
+}
+
+//======================================================
+// CLASS: BatchWriter
+// Purpose: Output of a plan batch. CSV goes to one file or
+//          stdout. Columns go to a directory holding one raw
+//          array per column, in the machine's byte order,
+//          plus plans.csv describing the numbers in plan.i32.
+//======================================================
+class BatchWriter {
+private:
+    static const int FILE_COUNT = 3 + BATCH_AMOUNTS;
+    BatchFormat format;
+    FILE* files[FILE_COUNT];    // CSV or plans.csv, then the columns
+    bool failed;
+
+    BatchWriter(const BatchWriter&) = delete;
+    BatchWriter& operator=(const BatchWriter&) = delete;
+
+    void put(int file, const void* data, size_t size) {
+        if (size > 0 && fwrite(data, 1, size, files[file]) != size) failed = true;
+    }
+
+public:
+    BatchWriter() : format(BATCH_CSV), failed(false) {
+        fill(files, files + FILE_COUNT, nullptr);
+    }
+
+    ~BatchWriter() {
+        close();
+    }
+
+    //======================================================
+    // FUNCTION: open
+    // Aim: Creates the output ("-" is stdout for CSV) and
+    //      writes the CSV header; false (and close() false) if
+    //      it cannot
+    //======================================================
+    bool open(const string& path, BatchFormat batchFormat) {
+        static const char* const NAMES[FILE_COUNT] = {
+            "plans.csv", "plan.i32", "month.i16", "payment.i64", "interest.i64", "principal.i64", "balance.i64"
+        };
+        format = batchFormat;
+        if (format == BATCH_CSV) {
+            files[0] = path == "-" ? stdout : fopen(path.c_str(), "wb");
+            if (files[0] == nullptr) failed = true;
+            if (failed) return false;
+            string header = "product,category,option,months,month,payment,interest,principal,balance\n";
+            put(0, header.data(), header.size());
+            return !failed;
+        }
+        error_code error;
+        filesystem::create_directories(path, error);
+        for (int f = 0; f < FILE_COUNT; f++) {
+            files[f] = fopen((filesystem::path(path) / NAMES[f]).string().c_str(), "wb");
+            if (files[f] == nullptr) failed = true;
+            if (failed) return false;
+        }
+        string header = "plan,product,category,option,months,monthly,total_paid\n";
+        put(0, header.data(), header.size());
+        return !failed;
+    }
+
+    BatchFormat outputFormat() const { return format; }
+
+    //======================================================
+    // FUNCTION: write
+    // Aim: Appends a block
+    //======================================================
+    void write(const BatchBlock& block) {
+        put(0, block.text.data(), block.text.size());
+        if (format != BATCH_COLUMNS) return;
+        put(1, block.plan.data(), block.plan.size() * sizeof(int32_t));
+        put(2, block.month.data(), block.month.size() * sizeof(int16_t));
+        for (int a = 0; a < BATCH_AMOUNTS; a++) {
+            put(3 + a, block.amounts[a].data(), block.amounts[a].size() * sizeof(int64_t));
+        }
+    }
+
+    //======================================================
+    // FUNCTION: close
+    // Aim: Flushes and closes every file; false if anything
+    //      failed to be written
+    //======================================================
+    bool close() {
+        for (int f = 0; f < FILE_COUNT; f++) {
+            if (files[f] == nullptr) continue;
+            if (fflush(files[f]) != 0 || ferror(files[f])) failed = true;
+            if (files[f] != stdout && fclose(files[f]) != 0) failed = true;
+            files[f] = nullptr;
+        }
+        return !failed;
+    }
+};
+
+//======================================================
+// STRUCTURE: NumberText
+// Purpose: A formatted number in a fixed buffer, usable
+//          wherever a string_view is
+//======================================================
+struct NumberText {
+    char text[64];
+    int length;
+
+    operator string_view() const { return string_view(text, length); }
+};
+
+//======================================================
+// ENUM: DigitGrouping
+// Purpose: How the rupee digits of an amount are grouped:
+//          1,234,567 (Western) or 12,34,567 (lakh/crore)
+//======================================================
+enum DigitGrouping {
+    GROUP_WESTERN,
+    GROUP_LAKH
+};
+
+//======================================================
+// FUNCTION: groupDigits
+// Aim: Copies count digits to out with grouping commas and
+//      returns the characters written
+//======================================================
+int groupDigits(const char* digits, int count, DigitGrouping grouping, char* out) {
+    int written = 0;
+    for (int i = 0; i < count; i++) {
+        int remaining = count - i;      // digits left, this one included
+        bool comma = grouping == GROUP_LAKH
+            ? remaining >= 3 && remaining % 2 == 1 && i > 0
+            : remaining % 3 == 0 && i > 0;
+        if (comma) out[written++] = ',';
+        out[written++] = digits[i];
+    }
+    return written;
+}
+
+//======================================================
+// FUNCTION: formatPaisa
+// Aim: Formats an amount held in paisa (1/100 rupee) with
+//      grouping commas, dropping a ".00" fraction
+//======================================================
+NumberText formatPaisa(int64_t paisa, DigitGrouping grouping = GROUP_WESTERN) {
+    uint64_t magnitude = paisa < 0 ? 0 - (uint64_t)paisa : (uint64_t)paisa;
+    int fraction = (int)(magnitude % 100);
+
+    char digits[24];
+    int count = (int)(to_chars(digits, digits + sizeof(digits), magnitude / 100).ptr - digits);
+
+    NumberText result;
+    int out = 0;
+    if (paisa < 0) result.text[out++] = '-';
+    out += groupDigits(digits, count, grouping, result.text + out);
+    if (fraction != 0) {
+        result.text[out++] = '.';
+        result.text[out++] = (char)('0' + fraction / 10);
+        result.text[out++] = (char)('0' + fraction % 10);
+    }
+    result.length = out;
+    return result;
+}
+
+//======================================================
+// FUNCTION: formatAmount
+// Aim: Formats number with commas for better readability,
+//      dropping a ".00" fraction. Rounds to whole paisa once
+//      and formats the integer, so no fraction digits come
+//      from binary floating point. Amounts beyond int64 paisa
+//      (and inf/nan) fall back to printf digits.
+//======================================================
+NumberText formatAmount(double num, DigitGrouping grouping = GROUP_WESTERN) {
+    if (fabs(num) < 9.0e16) {
+        return formatPaisa(llround(num * 100), grouping);
+    }
+
+    char plain[48];
+    int length = snprintf(plain, sizeof(plain), "%.0f", num);
+    if (length < 0 || length >= (int)sizeof(plain)) length = 0;
+    int digitsStart = length > 0 && plain[0] == '-' ? 1 : 0;
+
+    NumberText result;
+    memcpy(result.text, plain, digitsStart);
+    bool numeric = length > digitsStart && plain[digitsStart] >= '0' && plain[digitsStart] <= '9';
+    if (numeric) {
+        result.length = digitsStart + groupDigits(plain + digitsStart, length - digitsStart, grouping, result.text + digitsStart);
+    }
+    else {
+        memcpy(result.text, plain, length);
+        result.length = length;
+    }
+    return result;
+}
+
+//======================================================
+// STRUCTURE: QuotePanel
+// Purpose: Monthly payments of one loan for its suggested
+//          term (slot 0) and the standard terms, with their
+//          formatted text in the owning QuoteTable
+//======================================================
+static const int STANDARD_TERMS[] = { 12, 24, 36, 48, 60 };
+static const int QUOTE_SLOTS = 6;
+
+struct QuotePanel {
+    int32_t months[QUOTE_SLOTS];
+    Money monthly[QUOTE_SLOTS];
+    uint32_t textOffset[QUOTE_SLOTS];
+    uint8_t textLength[QUOTE_SLOTS];
+};
+
+//======================================================
+// CLASS: QuoteTable
+// Purpose: Quotes of every option of one loan table, computed
+//          and formatted once when the catalog is loaded.
+//          Options with the same loan amount and suggested term
+//          share one panel, so a table of many similar options
+//          stays small. Valid for the annual rate and digit
+//          grouping it was built with.
+//======================================================
+class QuoteTable {
+private:
+    vector<int32_t> panelOfRow;
+    vector<QuotePanel> panels;
+    string text;                // formatted amounts of all panels
+    double rate;
+    DigitGrouping grouping;
+
+    QuoteTable(const QuoteTable&) = delete;
+    QuoteTable& operator=(const QuoteTable&) = delete;
+
+public:
+    QuoteTable() : rate(-1), grouping(GROUP_WESTERN) {}
+
+    //======================================================
+    // FUNCTION: build
+    // Aim: Quotes options[0..count) at annualRate (percent)
+    //======================================================
+    void build(const LoanOption* options, int count, double annualRate, DigitGrouping digitGrouping) {
+        rate = annualRate;
+        grouping = digitGrouping;
+        panelOfRow.assign(count, 0);
+        panels.clear();
+        text.clear();
+
+        HashIndex byLoan;       // (loan amount, suggested term) -> panel
+        for (int row = 0; row < count; row++) {
+            Money principal = options[row].priceValue - options[row].downPaymentValue;
+            int suggested = options[row].installmentCount;
+            char key[sizeof(int64_t) + sizeof(int)];
+            memcpy(key, &principal.paisa, sizeof(int64_t));
+            memcpy(key + sizeof(int64_t), &suggested, sizeof(int));
+
+            int panel = byLoan.find(string_view(key, sizeof(key)));
+            if (panel < 0) {
+                panel = (int)panels.size();
+                byLoan.insert(string_view(key, sizeof(key)), panel);
+
+                QuotePanel quotes;
+                for (int slot = 0; slot < QUOTE_SLOTS; slot++) {
+                    int months = slot == 0 ? suggested : STANDARD_TERMS[slot - 1];
+                    Money monthly = ScheduleCursor(principal, annualRate, months).monthly();
+                    NumberText formatted = formatPaisa(monthly.paisa, grouping);
+                    quotes.months[slot] = months;
+                    quotes.monthly[slot] = monthly;
+                    quotes.textOffset[slot] = (uint32_t)text.size();
+                    quotes.textLength[slot] = (uint8_t)formatted.length;
+                    text.append(formatted.text, formatted.length);
+                }
+                panels.push_back(quotes);
+            }
+            panelOfRow[row] = panel;
+        }
+    }
+
+    //======================================================
+    // FUNCTION: find
+    // Aim: Panel of an option row, or nullptr if the table was
+    //      built for another rate or grouping (or not for this row)
+    //======================================================
+    const QuotePanel* find(int row, double annualRate, DigitGrouping digitGrouping) const {
+        if (annualRate != rate || digitGrouping != grouping || row < 0 || row >= (int)panelOfRow.size()) return nullptr;
+        return &panels[panelOfRow[row]];
+    }
+
+    //======================================================
+    // FUNCTION: slotFor
+    // Aim: Slot of a term in a panel, or -1
+    //======================================================
+    static int slotFor(const QuotePanel& panel, int months) {
+        for (int slot = 0; slot < QUOTE_SLOTS; slot++) {
+            if (panel.months[slot] == months) return slot;
+        }
+        return -1;
+    }
+
+    string_view amountText(const QuotePanel& panel, int slot) const {
+        return string_view(text.data() + panel.textOffset[slot], panel.textLength[slot]);
+    }
+
+    size_t panelCount() const { return panels.size(); }
+};
+
+//======================================================
+// LOAN FILTER
+// Affordability queries over every option of every product:
+// "down payment <= X and monthly installment <= Y at term T",
+// cheapest total cost first. The numbers the predicates need
+// are kept as columns, so a query is a few compares per row
+// in loops the compiler can vectorize.
+//======================================================
+static const int FILTER_SHOWN = 10;     // matches listed per query
+static const int FILTER_BLOCK = 256;    // rows per predicate pass
+
+//======================================================
+// STRUCTURE: FilterQuery
+// Purpose: Limits of one affordability query. A limit left at
+//          infinity is not checked; months = 0 means each
+//          option's own suggested term.
+//======================================================
+struct FilterQuery {
+    int product = -1;           // -1 = all products
+    double maxDownPayment = numeric_limits<double>::infinity();
+    double maxMonthly = numeric_limits<double>::infinity();
+    double maxPrice = numeric_limits<double>::infinity();
+    int months = 0;
+};
+
+//======================================================
+// STRUCTURE: FilterResult
+// Purpose: Match count of a query and its cheapest matches,
+//          ordered by total cost (down payment + installments)
+//======================================================
+struct FilterResult {
+    int scanned;
+    int matches;
+    int shown;
+    int32_t rows[FILTER_SHOWN];         // rows in the catalog's option array
+    int32_t months[FILTER_SHOWN];
+    Money monthly[FILTER_SHOWN];
+    Money totalCost[FILTER_SHOWN];
+};
+
+//======================================================
+// CLASS: OptionColumns
+// Purpose: Struct-of-arrays copy of the numbers of all loan
+//          options, one row per option in catalog order.
+//          Amounts are whole paisa held in doubles (exact up to
+//          2^53), so compares vectorize and agree with Money.
+//          The suggested-term payments depend on the rate, so
+//          the columns are rebuilt with the quote tables.
+//======================================================
+class OptionColumns {
+private:
+    vector<double> downPayment;
+    vector<double> principal;
+    vector<double> price;
+    vector<double> suggestedMonthly;    // infinity for rows without a term
+    vector<int32_t> suggestedMonths;
+    vector<Money> suggestedTotal;       // down payment + installments
+    double rate;
+
+    OptionColumns(const OptionColumns&) = delete;
+    OptionColumns& operator=(const OptionColumns&) = delete;
+
+    //======================================================
+    // FUNCTION: matchBlock
+    // Aim: Sets match[i] for rows [0, n) of three columns
+    //      against their limits. Branch-free, so it vectorizes.
+    //======================================================
+    static void matchBlock(const double* __restrict a, double aMax, const double* __restrict b, double bMax,
+        const double* __restrict c, double cMax, uint8_t* __restrict match, int n) {
+        for (int i = 0; i < n; i++) {
+            match[i] = (uint8_t)((a[i] <= aMax) & (b[i] <= bMax) & (c[i] <= cMax));
+        }
+    }
+
+public:
+    OptionColumns() : rate(-1) {}
+
+    //======================================================
+    // FUNCTION: build
+    // Aim: Fills the columns from options[0..count) at
+    //      annualRate (percent)
+    //======================================================
+    void build(const LoanOption* options, int count, double annualRate) {
+        rate = annualRate;
+        downPayment.resize(count);
+        principal.resize(count);
+        price.resize(count);
+        suggestedMonthly.resize(count);
+        suggestedMonths.resize(count);
+        suggestedTotal.resize(count);
+        for (int row = 0; row < count; row++) {
+            const LoanOption& option = options[row];
+            Money loanAmount = option.priceValue - option.downPaymentValue;
+            int months = option.installmentCount;
+            ScheduleCursor plan(loanAmount, annualRate, months);
+            downPayment[row] = (double)option.downPaymentValue.paisa;
+            principal[row] = (double)loanAmount.paisa;
+            price[row] = (double)option.priceValue.paisa;
+            suggestedMonths[row] = months;
+            suggestedMonthly[row] = months > 0 ? (double)plan.monthly().paisa : numeric_limits<double>::infinity();
+            suggestedTotal[row] = option.downPaymentValue + plan.totalPaid();
+        }
+    }
+
+    int size() const { return (int)price.size(); }
+
+    //======================================================
+    // FUNCTION: filter
+    // Aim: Runs query over rows [begin, end). Limits are
+    //      rounded to paisa like the amounts. At a fixed term
+    //      the payment is about principal * (payment of 1
+    //      paisa), so the monthly limit becomes a principal
+    //      limit, loosened to cover the rounding, and every
+    //      predicate is a plain column compare. Rows that pass
+    //      are gathered without branches; at a fixed term each
+    //      one's rounded payment is then checked exactly, and
+    //      the cheapest FILTER_SHOWN by the total cost the plan
+    //      shows are kept in order.
+    //======================================================
+    void filter(const FilterQuery& query, int begin, int end, FilterResult& result) const {
+        thread_local vector<int32_t> selected;
+        if ((int)selected.size() < FILTER_BLOCK) selected.resize(FILTER_BLOCK);
+
+        begin = max(begin, 0);
+        end = min(end, size());
+        result.scanned = max(end - begin, 0);
+        result.matches = 0;
+        result.shown = 0;
+
+        Money monthlyLimit = Money::fromRupees(query.maxMonthly);
+        double downLimit = (double)Money::fromRupees(query.maxDownPayment).paisa;
+        double priceLimit = (double)Money::fromRupees(query.maxPrice).paisa;
+        double growth = ScheduleCursor::termGrowth(rate, query.months);
+        const double* paymentColumn = query.months > 0 ? principal.data() : suggestedMonthly.data();
+        double paymentLimit = query.maxMonthly == numeric_limits<double>::infinity() ? query.maxMonthly
+            : (double)monthlyLimit.paisa;
+        if (query.months > 0) {
+            // Only a payment under limit + 1 paisa can round (tiny
+            // loans round down) to the limit or less; the slack
+            // covers ulps between this factor and the cursor's
+            double factor = monthlyPayment(1.0, rate, query.months);
+            paymentLimit = (paymentLimit + 1.0) / factor * (1.0 + 1e-9);
+        }
+
+        uint8_t match[FILTER_BLOCK];
+        for (int start = begin; start < end; start += FILTER_BLOCK) {
+            int n = min(FILTER_BLOCK, end - start);
+            matchBlock(downPayment.data() + start, downLimit, paymentColumn + start, paymentLimit,
+                price.data() + start, priceLimit, match, n);
+
+            int found = 0;
+            for (int i = 0; i < n; i++) {
+                selected[found] = start + i;
+                found += match[i];
+            }
+
+            for (int k = 0; k < found; k++) {
+                int row = selected[k];
+                int months = query.months > 0 ? query.months : suggestedMonths[row];
+                Money monthly = months > 0 ? Money::fromPaisa((int64_t)suggestedMonthly[row]) : Money();
+                Money total = suggestedTotal[row];
+                if (query.months > 0) {
+                    ScheduleCursor plan(Money::fromPaisa((int64_t)principal[row]), rate, months, growth);
+                    monthly = plan.monthly();
+                    if (monthly > monthlyLimit) continue;
+                    total = Money::fromPaisa((int64_t)downPayment[row]) + plan.totalPaid();
+                }
+                result.matches++;
+                if (result.shown == FILTER_SHOWN && !(total < result.totalCost[FILTER_SHOWN - 1])) continue;
+
+                // Insert in order; equal costs keep catalog order
+                int slot = result.shown < FILTER_SHOWN ? result.shown++ : FILTER_SHOWN - 1;
+                while (slot > 0 && total < result.totalCost[slot - 1]) {
+                    result.rows[slot] = result.rows[slot - 1];
+                    result.months[slot] = result.months[slot - 1];
+                    result.monthly[slot] = result.monthly[slot - 1];
+                    result.totalCost[slot] = result.totalCost[slot - 1];
+                    slot--;
+                }
+                result.rows[slot] = row;
+                result.months[slot] = months;
+                result.monthly[slot] = monthly;
+                result.totalCost[slot] = total;
+            }
+        }
+    }
+};
+
+//======================================================
+// ENUM: DialogStage
+// Purpose: Where a conversation currently is, i.e. what its
+//          next message answers
+//======================================================
+enum DialogStage {
+    STAGE_CHAT,
+    STAGE_CATEGORY,
+    STAGE_OPTION,
+    STAGE_TERM,
+    STAGE_PLAN_CONFIRM,
+    STAGE_PLAN_PAGE,
+    STAGE_FILTER,
+    STAGE_CONTINUE,
+    STAGE_ENDED
+};
+
+//======================================================
+// ENUM: DialogNeeds
+// Purpose: How much of a product selection a stage works on;
+//          each level includes the ones before it
+//======================================================
+enum DialogNeeds {
+    NEEDS_NOTHING,
+    NEEDS_PRODUCT,      // a product with options
+    NEEDS_CATEGORY,     // and one of its categories
+    NEEDS_OPTION,       // and one of its options
+    NEEDS_PLAN          // and a term, and a month within it
+};
+
+//======================================================
+// STRUCTURE: DialogStageInfo
+// Purpose: One row of the dialog table: the stage's name on
+//          the line protocol, its prompt (a printf format
+//          taking up to two numbers), what it needs, and
+//          whether X ends the conversation there
+//======================================================
+struct DialogStageInfo {
+    DialogStage stage;
+    const char* name;
+    const char* prompt;
+    DialogNeeds needs;
+    bool xExits;
+};
+
+static const DialogStageInfo DIALOG_STAGES[] = {
+    { STAGE_CHAT, "chat", "", NEEDS_NOTHING, true },
+    { STAGE_CATEGORY, "category", "Select category (1-%d): ", NEEDS_PRODUCT, true },
+    { STAGE_OPTION, "option", "Enter option number to view installment plan (1-%d), or 0 to skip: ", NEEDS_CATEGORY, true },
+    { STAGE_TERM, "term", "Enter your preferred number of installments (1-%d months): ", NEEDS_OPTION, true },
+    { STAGE_PLAN_CONFIRM, "plan", "Would you like to see a detailed installment plan? (Y/N): ", NEEDS_PLAN, true },
+    { STAGE_PLAN_PAGE, "page", "-- Months 1-%d of %d. Press Enter for more or X to skip to the total: ", NEEDS_PLAN, false },
+    { STAGE_FILTER, "filter", "Filters: ", NEEDS_NOTHING, true },
+    { STAGE_CONTINUE, "continue", "Press X to exit or any other key to continue: ", NEEDS_NOTHING, true },
+    { STAGE_ENDED, "ended", "", NEEDS_NOTHING, false }
+};
+static_assert(sizeof(DIALOG_STAGES) / sizeof(DIALOG_STAGES[0]) == STAGE_ENDED + 1, "one row per dialog stage");
+
+//======================================================
+// FUNCTION: stageName
+// Aim: Name of a dialog stage for the line protocol
+//======================================================
+const char* stageName(DialogStage stage) {
+    return stage >= STAGE_CHAT && stage <= STAGE_ENDED ? DIALOG_STAGES[stage].name : "chat";
+}
+
+//======================================================
+// STRUCTURE: SessionState
+// Purpose: Everything the headless engine remembers about
+//          one conversation between two messages
+//======================================================
+struct SessionState {
+    DialogStage stage = STAGE_CHAT;
+    int product = -1;           // number in the catalog's product registry
+    int category = -1;          // selected category number
+    int optionIndex = -1;       // row in the product's option array
+    int installments = 0;       // chosen number of months
+    int planMonth = 0;          // months of the plan already shown
+
+    static constexpr int ENCODED_BYTES = 21;
+
+    //======================================================
+    // FUNCTION: encode
+    // Aim: Writes the state as ENCODED_BYTES portable bytes:
+    //      the stage, then the five numbers as little-endian
+    //      int32
+    //======================================================
+    void encode(unsigned char* out) const {
+        const int32_t numbers[5] = { product, category, optionIndex, installments, planMonth };
+        out[0] = (unsigned char)stage;
+        for (int n = 0; n < 5; n++) {
+            uint32_t value = (uint32_t)numbers[n];
+            for (int b = 0; b < 4; b++) out[1 + 4 * n + b] = (unsigned char)(value >> (8 * b));
+        }
+    }
+
+    //======================================================
+    // FUNCTION: decode
+    // Aim: Reads a state written by encode. False if the stage
+    //      is unknown.
+    //======================================================
+    bool decode(const unsigned char* in) {
+        if (in[0] > STAGE_ENDED) return false;
+        int32_t numbers[5];
+        for (int n = 0; n < 5; n++) {
+            uint32_t value = 0;
+            for (int b = 0; b < 4; b++) value |= (uint32_t)in[1 + 4 * n + b] << (8 * b);
+            numbers[n] = (int32_t)value;
+        }
+        stage = (DialogStage)in[0];
+        product = numbers[0];
+        category = numbers[1];
+        optionIndex = numbers[2];
+        installments = numbers[3];
+        planMonth = numbers[4];
+        return true;
+    }
+};
+
+//======================================================
+// CLASS: SnapshotPointer
+// Purpose: RCU-style holder of an immutable snapshot. Readers
+//          pin the current snapshot with a Reader guard: two
+//          atomic increments on a per-thread-ish counter and two
+//          atomic loads of the phase, no locks. publish() swaps in a new
+//          snapshot, then waits until every reader that could
+//          still see the old one has left before deleting it.
+//======================================================
+template <class T>
+class SnapshotPointer {
+private:
+    static const int SLOTS = 64;
+
+    // Active reader counts per phase, one cache line per slot
+    struct alignas(64) ReaderSlot {
+        atomic<long> active[2];
+    };
+
+    atomic<T*> current;
+    atomic<int> phase;
+    ReaderSlot slots[SLOTS];
+    mutex writerLock;           // publishers only
+
+    SnapshotPointer(const SnapshotPointer&) = delete;
+    SnapshotPointer& operator=(const SnapshotPointer&) = delete;
+
+    static int slotIndex() {
+        static atomic<int> nextSlot(0);
+        thread_local int index = nextSlot.fetch_add(1) % SLOTS;
+        return index;
+    }
+
+public:
+    //======================================================
+    // CLASS: Reader
+    // Purpose: Pins the current snapshot while in scope
+    //======================================================
+    class Reader {
+    private:
+        SnapshotPointer& owner;
+        int slot;
+        int readerPhase;
+        const T* snapshot;
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+    public:
+        explicit Reader(SnapshotPointer& pointer) : owner(pointer), slot(slotIndex()) {
+            // A publisher that flipped the phase between the load and
+            // the increment no longer waits on this count: retry under
+            // the new phase, or the snapshot could be freed under us
+            while (true) {
+                readerPhase = owner.phase.load();
+                owner.slots[slot].active[readerPhase].fetch_add(1);
+                if (owner.phase.load() == readerPhase) break;
+                owner.slots[slot].active[readerPhase].fetch_sub(1);
+            }
+            snapshot = owner.current.load();
+        }
+        ~Reader() {
+            owner.slots[slot].active[readerPhase].fetch_sub(1);
+        }
+        const T& operator*() const { return *snapshot; }
+        const T* operator->() const { return snapshot; }
+    };
+
+    explicit SnapshotPointer(T* initial) : current(initial), phase(0) {
+        for (int i = 0; i < SLOTS; i++) {
+            slots[i].active[0] = 0;
+            slots[i].active[1] = 0;
+        }
+    }
+
+    ~SnapshotPointer() {
+        delete current.load();
+    }
+
+    //======================================================
+    // FUNCTION: publish
+    // Aim: Makes next the current snapshot (taking ownership)
+    //      and frees the previous one after the grace period
+    //======================================================
+    void publish(T* next) {
+        lock_guard<mutex> guard(writerLock);
+        T* old = current.exchange(next);
+
+        // Readers that start from now on see next. Flip the phase and
+        // wait out everyone who entered under the old one.
+        int oldPhase = phase.load();
+        phase.store(1 - oldPhase);
+        for (int i = 0; i < SLOTS; i++) {
+            while (slots[i].active[oldPhase].load() != 0) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        }
+        delete old;
+    }
+
+    //======================================================
+    // FUNCTION: unpublished
+    // Aim: Writable access to the snapshot for setup, before
+    //      any reader or publisher can exist
+    //======================================================
+    T* unpublished() { return current.load(); }
+};
+
+//======================================================
+// STRUCTURE: CatalogFiles
+// Purpose: The files a catalog is built from. The loan table
+//          files are named in the products file.
+//======================================================
+struct CatalogFiles {
+    string utterances;
+    string products;
+    string image;       // precompiled catalog, used instead of the text files when current
+    string synonyms;    // optional phrase#canonical table for input normalization
+};
+
+//======================================================
+// PRODUCT REGISTRY
+// Loan products are declared one per line of the products
+// file (Products.txt):
+//     Keys#Name#File#Schema[#Unavailable message]
+// Keys are the chat inputs that pick the product (comma
+// separated, any case). Schema names the header columns that
+// hold the category, details, installments, price and down
+// payment, comma separated, in that order; an empty schema
+// takes the first five columns as they are. The message is
+// shown while the product has no options. Without a products
+// file, DEFAULT_PRODUCTS applies.
+//======================================================
+static const int LOAN_COLUMNS = 5;
+
+//======================================================
+// STRUCTURE: LoanProduct
+// Purpose: One declared loan product (views into the catalog
+//          arena or DEFAULT_PRODUCTS)
+//======================================================
+struct LoanProduct {
+    string_view keys;           // lowercase, comma separated
+    string_view name;
+    string_view file;
+    string_view columns[LOAN_COLUMNS];     // empty: positional
+    string_view unavailable;
+};
+
+static constexpr LoanProduct DEFAULT_PRODUCTS[] = {
+    { "h", "Home", "Home.txt", { "Area", "Size", "Installments", "Price", "Down Payment" },
+        "No Home loan options available at this time." },
+    { "c", "Car", "Car.txt", {}, "(Car loan options will be available in future updates)" },
+    { "e,b", "Electric Bike", "Bike.txt", {}, "(Electric bike loan options will be available in future updates)" },
+};
+static constexpr int DEFAULT_PRODUCT_COUNT = sizeof(DEFAULT_PRODUCTS) / sizeof(DEFAULT_PRODUCTS[0]);
+
+//======================================================
+// EMBEDDED DEFAULTS
+// The shipped utterances, synonyms and home loan table are
+// compiled in, so the bot starts without any data file and
+// without parsing. Files on disk take precedence:
+// - Utterances.txt entries override built-in ones with the
+//   same input, and built-in inputs it lacks are added;
+// - Synonyms.txt lines come before the built-in synonyms;
+// - a loan table file replaces the built-in table of the
+//   same name.
+// Built-in inputs are already normalized. They are found
+// through a perfect hash that the compiler builds.
+//======================================================
+static constexpr Utterance EMBEDDED_UTTERANCES[] = {
+    { "hi", "Hello! Please press A if you want to apply for a loan. Press X to exit" },
+    { "hello", "Hi! Please press A if you want to apply for a loan. Press X to exit" },
+    { "aoa", "WaS! Please press A if you want to apply for a loan. Press X to exit" },
+    { "salam", "Wa alaikum salam! Please press A if you want to apply for a loan. Press X to exit" },
+    { "a", "Please select the category you want to apply for. Press H for a home loan, C for a car loan, "
+        "E for an electric bike loan, or F to find the options that fit your budget. Press X to exit" },
+    { "f", "Tell me your budget and I will search every loan option, cheapest total cost first. "
+        "For example: home down 20 lakh monthly 150k 60 months" },
+    { "h", "You are applying for a home loan. Please select area. Options are 1, 2, 3, 4" },
+};
+static constexpr int EMBEDDED_UTTERANCE_COUNT = sizeof(EMBEDDED_UTTERANCES) / sizeof(EMBEDDED_UTTERANCES[0]);
+static constexpr string_view EMBEDDED_DEFAULT_RESPONSE =
+    "Hi! I'll be happy to help. Please press A if you want to apply for loan. Press X to exit";
+
+static constexpr TextNormalizer::Synonym EMBEDDED_SYNONYMS[] = {
+    { "salaam", "salam" }, { "slam", "salam" }, { "asalam", "salam" }, { "assalam", "salam" },
+    { "assalam o alaikum", "aoa" }, { "assalam u alaikum", "aoa" }, { "assalamu alaikum", "aoa" },
+    { "assalamualaikum", "aoa" }, { "asalam o alaikum", "aoa" }, { "asalamualaikum", "aoa" },
+    { "salam alaikum", "aoa" }, { "slam alaikum", "aoa" },
+    { "\u0627\u0644\u0633\u0644\u0627\u0645 \u0639\u0644\u06CC\u06A9\u0645", "aoa" },       // assalam alaikum
+    { "\u0627\u0633\u0644\u0627\u0645 \u0639\u0644\u06CC\u06A9\u0645", "aoa" },
+    { "\u0633\u0644\u0627\u0645", "salam" },
+    { "\u06C1\u06CC\u0644\u0648", "hello" },
+    { "helo", "hello" }, { "hy", "hi" }, { "hey", "hi" },
+};
+static constexpr int EMBEDDED_SYNONYM_COUNT = sizeof(EMBEDDED_SYNONYMS) / sizeof(EMBEDDED_SYNONYMS[0]);
+
+static constexpr LoanOption EMBEDDED_HOME_OPTIONS[] = {
+    { "Area 1", "5 Marla", "60", "10,000,000", "1,000,000", { 1000000000 }, { 100000000 }, 60 },
+    { "Area 1", "5 Marla", "48", "9,500,000", "2,000,000", { 950000000 }, { 200000000 }, 48 },
+    { "Area 1", "5 Marla", "36", "8,500,000", "3,000,000", { 850000000 }, { 300000000 }, 36 },
+};
+
+//======================================================
+// STRUCTURE: EmbeddedTable
+// Purpose: A built-in loan table, used when the file a
+//          product names does not exist
+//======================================================
+struct EmbeddedTable {
+    string_view file;
+    const LoanOption* rows;
+    int count;
+};
+
+static constexpr EmbeddedTable EMBEDDED_TABLES[] = {
+    { "Home.txt", EMBEDDED_HOME_OPTIONS, sizeof(EMBEDDED_HOME_OPTIONS) / sizeof(EMBEDDED_HOME_OPTIONS[0]) },
+};
+
+//======================================================
+// FUNCTION: embeddedHash
+// Aim: FNV-1a hash of text, started from seed; constexpr so
+//      the perfect hash of the built-in inputs is compiled
+//======================================================
+constexpr uint32_t embeddedHash(string_view text, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (size_t i = 0; i < text.size(); i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+//======================================================
+// STRUCTURE: EmbeddedIndex
+// Purpose: Collision-free hash of the built-in inputs: the
+//          utterance in slot hash(input, seed) & (SLOTS - 1),
+//          or -1
+//======================================================
+struct EmbeddedIndex {
+    static constexpr int SLOTS = 32;
+    static constexpr uint32_t NO_SEED = 0xFFFFFFFF;
+    uint32_t seed = NO_SEED;
+    int8_t slot[SLOTS] = {};
+
+    //======================================================
+    // FUNCTION: build
+    // Aim: Tries seeds until the built-in inputs all land in
+    //      different slots. Only ever evaluated by the compiler.
+    //======================================================
+    static constexpr EmbeddedIndex build() {
+        EmbeddedIndex index;
+        for (uint32_t seed = 0; seed < 100000; seed++) {
+            bool clash = false;
+            for (int s = 0; s < SLOTS; s++) index.slot[s] = -1;
+            for (int u = 0; u < EMBEDDED_UTTERANCE_COUNT && !clash; u++) {
+                int s = (int)(embeddedHash(EMBEDDED_UTTERANCES[u].input, seed) & (SLOTS - 1));
+                if (index.slot[s] >= 0) clash = true;
+                else index.slot[s] = (int8_t)u;
+            }
+            if (!clash) {
+                index.seed = seed;
+                return index;
+            }
+        }
+        return index;
+    }
+
+    //======================================================
+    // FUNCTION: find
+    // Aim: Built-in utterance with this normalized input, or -1
+    //======================================================
+    int find(string_view input) const {
+        int u = slot[embeddedHash(input, seed) & (SLOTS - 1)];
+        return u >= 0 && EMBEDDED_UTTERANCES[u].input == input ? u : -1;
+    }
+};
+
+static constexpr EmbeddedIndex EMBEDDED_INDEX = EmbeddedIndex::build();
+static_assert(EMBEDDED_UTTERANCE_COUNT <= EmbeddedIndex::SLOTS / 2, "keep the perfect hash sparse");
+static_assert(EMBEDDED_INDEX.seed != EmbeddedIndex::NO_SEED, "built-in inputs must be distinct");
+
+//======================================================
+// STRUCTURE: ProductTable
+// Purpose: A product and its slice [first, first + count) of
+//          the catalog's one loan option array, with the
+//          category index and quotes of that slice
+//======================================================
+struct ProductTable {
+    LoanProduct product;
+    int first = 0;
+    int count = 0;
+    CategoryIndex categories;
+    QuoteTable quotes;
+};
+
+//======================================================
+// CATALOG IMAGE
+// Binary, precompiled form of a whole catalog (--compile-catalog),
+// opened with one mmap and no parsing. Layout: an ImageHeader,
+// then 8-byte aligned arrays it points at by file offset (string
+// references, typed number columns, prebuilt hash slots, category
+// indexes), then one string pool. Numbers are in host byte order;
+// an image from a machine with the other order is rejected.
+//======================================================
+static const char IMAGE_MAGIC[8] = { 'L', 'B', 'C', 'A', 'T', 'A', 'L', 'G' };
+static const uint32_t IMAGE_VERSION = 5;
+static const uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+//======================================================
+// STRUCTURE: ImageSpan
+// Purpose: An array inside the image: file offset and
+//          number of elements
+//======================================================
+struct ImageSpan {
+    uint64_t offset;
+    uint64_t count;
+};
+
+//======================================================
+// STRUCTURE: ImageString
+// Purpose: A string in the image's string pool
+//======================================================
+struct ImageString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+//======================================================
+// STRUCTURE: ImageHash
+// Purpose: A prebuilt HashIndex: slots, key pool, key count
+//======================================================
+struct ImageHash {
+    ImageSpan slots;
+    ImageSpan keys;
+    uint64_t used;
+};
+
+//======================================================
+// STRUCTURE: ImageTable
+// Purpose: One loan table as columns plus its category index
+//======================================================
+struct ImageTable {
+    ImageSpan category;         // ImageString columns
+    ImageSpan details;
+    ImageSpan installments;
+    ImageSpan price;
+    ImageSpan downPayment;
+    ImageSpan priceValue;       // int64_t paisa
+    ImageSpan downPaymentValue; // int64_t paisa
+    ImageSpan installmentCount; // int32_t
+    ImageSpan categoryNames;    // ImageString
+    ImageSpan categoryOffsets;  // int32_t, categories + 1
+    ImageSpan categoryRows;     // int32_t
+    ImageHash categoryKeys;
+};
+
+//======================================================
+// STRUCTURE: ImageProduct
+// Purpose: One product declaration and its loan table
+//======================================================
+struct ImageProduct {
+    ImageString keys;
+    ImageString name;
+    ImageString file;
+    ImageString columns[LOAN_COLUMNS];
+    ImageString unavailable;
+    ImageTable table;
+};
+
+//======================================================
+// STRUCTURE: ImageHeader
+// Purpose: Start of a catalog image. checksum covers every
+//          byte after the header.
+//======================================================
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint64_t checksum;
+    ImageSpan pool;             // char
+    ImageSpan inputs;           // ImageString, lowercased
+    ImageSpan responses;        // ImageString
+    ImageHash utteranceKeys;
+    ImageString defaultResponse;
+    ImageSpan products;         // ImageProduct
+    uint64_t sources;           // Catalog::presentSources when compiled
+};
+
+//======================================================
+// FUNCTION: imageChecksum
+// Aim: FNV-1a over 8-byte words (then the tail bytes), fast
+//      enough to verify a large image at startup
+//======================================================
+uint64_t imageChecksum(string_view bytes) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t words = bytes.size() / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes.data() + i * 8, 8);
+        h = (h ^ word) * 1099511628211ULL;
+    }
+    for (size_t i = words * 8; i < bytes.size(); i++) {
+        h = (h ^ (unsigned char)bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+//======================================================
+// CLASS: ImageWriter
+// Purpose: Lays out a catalog image in memory: arrays are
+//          appended 8-byte aligned, strings go to a separate
+//          pool that finish() places last. Repeated strings
+//          (category names, amounts) are pooled once.
+//======================================================
+class ImageWriter {
+private:
+    string bytes;
+    string pool;
+    HashIndex pooled;       // text -> its offset in pool
+
+public:
+    ImageWriter() : bytes(sizeof(ImageHeader), '\0') {}
+
+    //======================================================
+    // FUNCTION: append
+    // Aim: Copies count elements into the image
+    //======================================================
+    template <class T>
+    ImageSpan append(const T* data, size_t count) {
+        bytes.resize((bytes.size() + 7) & ~(size_t)7, '\0');
+        ImageSpan span = { bytes.size(), count };
+        if (count > 0) bytes.append((const char*)data, count * sizeof(T));
+        return span;
+    }
+
+    //======================================================
+    // FUNCTION: addString
+    // Aim: Puts text in the string pool
+    //======================================================
+    ImageString addString(string_view text) {
+        int offset = pooled.find(text);
+        if (offset >= 0) {
+            return ImageString{ (uint32_t)offset, (uint32_t)text.size() };
+        }
+        ImageString ref = { (uint32_t)pool.size(), (uint32_t)text.size() };
+        if (pool.size() < 0x7FFFFFFF) pooled.insert(text, (int)pool.size());
+        pool.append(text.data(), text.size());
+        return ref;
+    }
+
+    //======================================================
+    // FUNCTION: addHash
+    // Aim: Copies a HashIndex's slots and key pool as is
+    //======================================================
+    ImageHash addHash(const HashIndex& index) {
+        ImageHash hash;
+        hash.slots = append(index.slotData(), index.slotCount());
+        hash.keys = append(index.keyData().data(), index.keyData().size());
+        hash.used = index.size();
+        return hash;
+    }
+
+    //======================================================
+    // FUNCTION: finish
+    // Aim: Appends the pool, fills in the header and returns
+    //      the image bytes. Returns false if the pool or file
+    //      is too large for 32-bit string offsets.
+    //======================================================
+    bool finish(ImageHeader& header, string& image) {
+        if (pool.size() > 0xFFFFFFFFu) return false;
+        header.pool = append(pool.data(), pool.size());
+        memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+        header.version = IMAGE_VERSION;
+        header.byteOrder = IMAGE_BYTE_ORDER;
+        header.fileSize = bytes.size();
+        header.checksum = imageChecksum(string_view(bytes).substr(sizeof(ImageHeader)));
+        memcpy(&bytes[0], &header, sizeof(header));
+        image.swap(bytes);
+        return true;
+    }
+};
+
+//======================================================
+// CLASS: ImageReader
+// Purpose: Bounds-checked access to the arrays of a mapped
+//          image
+//======================================================
+class ImageReader {
+private:
+    string_view bytes;
+    string_view pool;
+
+public:
+    explicit ImageReader(string_view image) : bytes(image) {}
+
+    void setPool(string_view stringPool) { pool = stringPool; }
+
+    //======================================================
+    // FUNCTION: array
+    // Aim: Pointer to an array of T, or nullptr if the span is
+    //      misaligned or outside the image
+    //======================================================
+    template <class T>
+    const T* array(const ImageSpan& span) const {
+        if (span.offset % 8 != 0 || span.offset > bytes.size() ||
+            span.count > (bytes.size() - span.offset) / sizeof(T)) {
+            return nullptr;
+        }
+        return (const T*)(bytes.data() + span.offset);
+    }
+
+    //======================================================
+    // FUNCTION: text
+    // Aim: View of a pooled string; false if out of range
+    //======================================================
+    bool text(const ImageString& ref, string_view& value) const {
+        if ((uint64_t)ref.offset + ref.length > pool.size()) return false;
+        value = pool.substr(ref.offset, ref.length);
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: hash
+    // Aim: Points index at prebuilt slots in the image whose
+    //      values must be below valueLimit
+    //======================================================
+    bool hash(const ImageHash& image, HashIndex& index, int valueLimit) const {
+        const HashIndex::Slot* slots = array<HashIndex::Slot>(image.slots);
+        const char* keys = array<char>(image.keys);
+        if (slots == nullptr || keys == nullptr) return false;
+        return index.adopt(slots, image.slots.count, string_view(keys, image.keys.count), image.used, valueLimit);
+    }
+};
+
+//======================================================
+// CLASS: Catalog
+// Purpose: One immutable snapshot of everything loaded from
+//          the data files: utterances and their index, the
+//          product registry, and every product's loan options
+//          with their category indexes. Built once, then only
+//          read; a reload builds a whole new Catalog.
+//======================================================
+class Catalog {
+private:
+    Catalog(const Catalog&) = delete;
+    Catalog& operator=(const Catalog&) = delete;
+
+    //======================================================
+    // FUNCTION: parseCount
+    // Aim: Parses a whole number made of digits only
+    //======================================================
+    static bool parseCount(string_view str, int& value) {
+        if (str.empty() || str.size() > 9) return false;
+        value = 0;
+        for (size_t i = 0; i < str.size(); i++) {
+            if (str[i] < '0' || str[i] > '9') return false;
+            value = value * 10 + (str[i] - '0');
+        }
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: resizeUtterances
+    // Aim: Expands the utterances array size dynamically
+    //      when capacity is reached.
+    //======================================================
+    void resizeUtterances() {
+        utteranceCapacity *= 2;
+        Utterance* newUtterances = new Utterance[utteranceCapacity];
+        for (int i = 0; i < utteranceCount; i++) {
+            newUtterances[i] = utterances[i];
+        }
+        delete[] utterances;
+        utterances = newUtterances;
+    }
+
+    //======================================================
+    // FUNCTION: reserveUtterances
+    // Aim: Grows the utterances array to at least capacity in
+    //      one step (views are cheap to move)
+    //======================================================
+    void reserveUtterances(int capacity) {
+        if (capacity <= utteranceCapacity) return;
+        Utterance* newUtterances = new Utterance[capacity];
+        for (int i = 0; i < utteranceCount; i++) {
+            newUtterances[i] = utterances[i];
+        }
+        delete[] utterances;
+        utterances = newUtterances;
+        utteranceCapacity = capacity;
+    }
+
+    //======================================================
+    // FUNCTION: appendUtterance
+    // Aim: Stores one pair of arena views and indexes the
+    //      normalized input. Duplicate inputs are stored but
+    //      the index keeps the first one, as the scan did.
+    //======================================================
+    void appendUtterance(string_view normalInput, string_view response) {
+        if (utteranceCount >= utteranceCapacity) {
+            resizeUtterances();
+        }
+        utterances[utteranceCount].input = normalInput;
+        utterances[utteranceCount].response = response;
+        utteranceIndex.insert(normalInput, utteranceCount);
+        utteranceCount++;
+    }
+
+    //======================================================
+    // FUNCTION: reserveLoanArray
+    // Aim: Grows a loan option array to at least capacity
+    //      in one step
+    //======================================================
+    void reserveLoanArray(LoanOption*& array, int count, int& capacity, int needed) {
+        if (needed <= capacity) return;
+        LoanOption* newArray = new LoanOption[needed];
+        for (int i = 0; i < count; i++) {
+            newArray[i] = array[i];
+        }
+        delete[] array;
+        array = newArray;
+        capacity = needed;
+    }
+
+    //======================================================
+    // FUNCTION: sameColumn
+    // Aim: Header column name comparison, ignoring case and
+    //      surrounding whitespace
+    //======================================================
+    static bool sameColumn(string_view header, string_view column) {
+        header = trimView(header);
+        if (header.size() != column.size()) return false;
+        for (size_t i = 0; i < header.size(); i++) {
+            char a = header[i], b = column[i];
+            if (a >= 'A' && a <= 'Z') a = (char)(a + 32);
+            if (b >= 'A' && b <= 'Z') b = (char)(b + 32);
+            if (a != b) return false;
+        }
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: resetProducts
+    // Aim: Empties the product registry and the loan option
+    //      array, with room for capacity products
+    //======================================================
+    void resetProducts(int capacity) {
+        delete[] products;
+        products = new ProductTable[capacity > 0 ? capacity : 1];
+        productCount = 0;
+        productKeys.clear();
+        loanOptionCount = 0;
+    }
+
+    //======================================================
+    // FUNCTION: indexProductKeys
+    // Aim: Maps every chat key of every product to it. A key
+    //      used twice stays with the first product.
+    //======================================================
+    void indexProductKeys() {
+        productKeys.clear();
+        for (int p = 0; p < productCount; p++) {
+            string_view keys = products[p].product.keys;
+            while (!keys.empty()) {
+                string_view key = trimView(nextField(keys, ','));
+                if (!key.empty()) productKeys.insert(key, p);
+            }
+        }
+    }
+
+    //======================================================
+    // FUNCTION: parseProducts
+    // Aim: Fills the registry from products file text. Bad
+    //      lines are reported and skipped.
+    //======================================================
+    void parseProducts(string_view text, string_view source) {
+        resetProducts(countLines(text));
+        int lineNumber = 0;
+        while (!text.empty()) {
+            string_view line = nextField(text, '\n');
+            lineNumber++;
+            if (trimView(line).empty()) continue;
+
+            LoanProduct product;
+            product.keys = arena.storeLower(trimView(nextField(line, '#')));
+            product.name = trimView(nextField(line, '#'));
+            product.file = trimView(nextField(line, '#'));
+            string_view schema = trimView(nextField(line, '#'));
+            product.unavailable = trimView(line);
+
+            const char* error = nullptr;
+            if (product.keys.empty() || product.name.empty() || product.file.empty()) {
+                error = "expected Keys#Name#File#Schema";
+            }
+            else if (!schema.empty()) {
+                for (int c = 0; c < LOAN_COLUMNS; c++) {
+                    product.columns[c] = trimView(nextField(schema, ','));
+                    if (product.columns[c].empty()) error = "the schema needs 5 column names";
+                }
+            }
+            if (error != nullptr) {
+                Screen errors(stderr);
+                errors.color(LIGHT_RED) << "Error: " << source << ":" << lineNumber << ": " << error << ", product skipped\n";
+                errors.color(WHITE);
+                continue;
+            }
+            if (product.unavailable.empty()) {
+                product.unavailable = arena.store("(" + string(product.name) + " loan options will be available in future updates)");
+            }
+            products[productCount++].product = product;
+        }
+        indexProductKeys();
+    }
+
+    //======================================================
+    // FUNCTION: sourceFiles
+    // Aim: The text files a catalog is loaded from, in load
+    //      order; the products' loan files come from the
+    //      products already loaded
+    //======================================================
+    vector<string> sourceFiles(const CatalogFiles& files) const {
+        vector<string> sources = { files.utterances, files.products, files.synonyms };
+        for (int p = 0; p < productCount; p++) {
+            sources.push_back(string(products[p].product.file));
+        }
+        return sources;
+    }
+
+    //======================================================
+    // FUNCTION: presentSources
+    // Aim: Hash of which source files exist (their names in
+    //      load order), so an image can tell a file that was
+    //      deleted or added since it was compiled
+    //======================================================
+    uint64_t presentSources(const CatalogFiles& files) const {
+        uint64_t h = 14695981039346656037ULL;
+        for (const string& source : sourceFiles(files)) {
+            error_code error;
+            if (source.empty() || !filesystem::exists(source, error)) continue;
+            h = (h ^ HashIndex::hashKey(source)) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    //======================================================
+    // FUNCTION: imageIsCurrent
+    // Aim: True if the image exists, no text file was changed
+    //      after it was compiled, and the same text files exist
+    //      as then. An image whose header cannot be read is
+    //      left for loadImage to reject.
+    //======================================================
+    bool imageIsCurrent(const CatalogFiles& files) const {
+        if (files.image.empty()) return false;
+        error_code error;
+        filesystem::file_time_type compiled = filesystem::last_write_time(files.image, error);
+        if (error) return false;
+
+        for (const string& source : sourceFiles(files)) {
+            filesystem::file_time_type changed = filesystem::last_write_time(source, error);
+            if (!error && changed > compiled) return false;
+        }
+
+        ImageHeader header;
+        ifstream image(files.image, ios::binary);
+        if (!image.read((char*)&header, sizeof(header)) || memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+            header.version != IMAGE_VERSION) {
+            return true;
+        }
+        return header.sources == presentSources(files);
+    }
+
+    //======================================================
+    // FUNCTION: writeTable
+    // Aim: Adds one loan table and its category index to an
+    //      image
+    //======================================================
+    static void writeTable(ImageWriter& writer, const LoanOption* options, int count,
+        const CategoryIndex& categories, ImageTable& table) {
+        vector<ImageString> text[5];
+        vector<int64_t> priceValues(count), downPaymentValues(count);
+        vector<int32_t> installmentCounts(count);
+        for (int i = 0; i < count; i++) {
+            text[0].push_back(writer.addString(options[i].category));
+            text[1].push_back(writer.addString(options[i].details));
+            text[2].push_back(writer.addString(options[i].installments));
+            text[3].push_back(writer.addString(options[i].price));
+            text[4].push_back(writer.addString(options[i].downPayment));
+            priceValues[i] = options[i].priceValue.paisa;
+            downPaymentValues[i] = options[i].downPaymentValue.paisa;
+            installmentCounts[i] = options[i].installmentCount;
+        }
+        table.category = writer.append(text[0].data(), count);
+        table.details = writer.append(text[1].data(), count);
+        table.installments = writer.append(text[2].data(), count);
+        table.price = writer.append(text[3].data(), count);
+        table.downPayment = writer.append(text[4].data(), count);
+        table.priceValue = writer.append(priceValues.data(), count);
+        table.downPaymentValue = writer.append(downPaymentValues.data(), count);
+        table.installmentCount = writer.append(installmentCounts.data(), count);
+
+        int categoryCount = categories.categoryCount();
+        vector<ImageString> names(categoryCount);
+        for (int c = 0; c < categoryCount; c++) {
+            names[c] = writer.addString(categories.name(c));
+        }
+        table.categoryNames = writer.append(names.data(), categoryCount);
+        table.categoryOffsets = writer.append(categories.offsetData(), categoryCount + 1);
+        table.categoryRows = writer.append(categories.rowData(), count);
+        table.categoryKeys = writer.addHash(categories.keys());
+    }
+
+    //======================================================
+    // FUNCTION: readUtterances
+    // Aim: Fills the utterance array from an image and adopts
+    //      its prebuilt hash index
+    //======================================================
+    bool readUtterances(const ImageReader& reader, const ImageHeader& header) {
+        const ImageString* inputs = reader.array<ImageString>(header.inputs);
+        const ImageString* responses = reader.array<ImageString>(header.responses);
+        if (inputs == nullptr || responses == nullptr || header.inputs.count != header.responses.count ||
+            header.inputs.count > 0x7FFFFFFF) {
+            return false;
+        }
+
+        int count = (int)header.inputs.count;
+        reserveUtterances(count);
+        for (int i = 0; i < count; i++) {
+            if (!reader.text(inputs[i], utterances[i].input) || !reader.text(responses[i], utterances[i].response)) {
+                return false;
+            }
+        }
+        utteranceCount = count;
+        return reader.text(header.defaultResponse, defaultResponse) &&
+            reader.hash(header.utteranceKeys, utteranceIndex, count);
+    }
+
+    //======================================================
+    // FUNCTION: readTable
+    // Aim: Appends one loan table from image columns to the
+    //      option array and takes its prebuilt category index
+    //======================================================
+    bool readTable(const ImageReader& reader, const ImageTable& table, ProductTable& product) {
+        uint64_t rows = table.category.count;
+        const ImageString* text[5] = {
+            reader.array<ImageString>(table.category), reader.array<ImageString>(table.details),
+            reader.array<ImageString>(table.installments), reader.array<ImageString>(table.price),
+            reader.array<ImageString>(table.downPayment)
+        };
+        const ImageSpan* spans[5] = { &table.category, &table.details, &table.installments, &table.price, &table.downPayment };
+        for (int f = 0; f < 5; f++) {
+            if (text[f] == nullptr || spans[f]->count != rows) return false;
+        }
+        const int64_t* priceValues = reader.array<int64_t>(table.priceValue);
+        const int64_t* downPaymentValues = reader.array<int64_t>(table.downPaymentValue);
+        const int32_t* installmentCounts = reader.array<int32_t>(table.installmentCount);
+        if (priceValues == nullptr || downPaymentValues == nullptr || installmentCounts == nullptr ||
+            table.priceValue.count != rows || table.downPaymentValue.count != rows ||
+            table.installmentCount.count != rows || rows > (uint64_t)(0x7FFFFFFF - loanOptionCount)) {
+            return false;
+        }
+
+        reserveLoanArray(loanOptions, loanOptionCount, loanOptionCapacity, loanOptionCount + (int)rows);
+        LoanOption* options = loanOptions + loanOptionCount;
+        for (uint64_t i = 0; i < rows; i++) {
+            LoanOption& option = options[i];
+            if (!reader.text(text[0][i], option.category) || !reader.text(text[1][i], option.details) ||
+                !reader.text(text[2][i], option.installments) || !reader.text(text[3][i], option.price) ||
+                !reader.text(text[4][i], option.downPayment)) {
+                return false;
+            }
+            option.priceValue = Money::fromPaisa(priceValues[i]);
+            option.downPaymentValue = Money::fromPaisa(downPaymentValues[i]);
+            option.installmentCount = installmentCounts[i];
+        }
+        product.first = loanOptionCount;
+        product.count = (int)rows;
+        loanOptionCount += (int)rows;
+
+        const ImageString* nameRefs = reader.array<ImageString>(table.categoryNames);
+        const int32_t* offsets = reader.array<int32_t>(table.categoryOffsets);
+        const int32_t* categoryRows = reader.array<int32_t>(table.categoryRows);
+        if (nameRefs == nullptr || offsets == nullptr || categoryRows == nullptr ||
+            table.categoryOffsets.count != table.categoryNames.count + 1 || table.categoryRows.count != rows) {
+            return false;
+        }
+        vector<string_view> names(table.categoryNames.count);
+        for (size_t c = 0; c < names.size(); c++) {
+            if (!reader.text(nameRefs[c], names[c])) return false;
+        }
+        return product.categories.assign(names, offsets, categoryRows, product.count) &&
+            reader.hash(table.categoryKeys, product.categories.keys(), (int)names.size()) &&
+            product.categories.keys().size() == names.size();
+    }
+
+    //======================================================
+    // FUNCTION: readProducts
+    // Aim: Replaces the registry with the products of an image
+    //======================================================
+    bool readProducts(const ImageReader& reader, const ImageHeader& header) {
+        const ImageProduct* stored = reader.array<ImageProduct>(header.products);
+        if (stored == nullptr || header.products.count > 0xFFFF) return false;
+
+        resetProducts((int)header.products.count);
+        for (uint64_t p = 0; p < header.products.count; p++) {
+            LoanProduct& product = products[p].product;
+            bool valid = reader.text(stored[p].keys, product.keys) && reader.text(stored[p].name, product.name) &&
+                reader.text(stored[p].file, product.file) && reader.text(stored[p].unavailable, product.unavailable);
+            for (int c = 0; c < LOAN_COLUMNS && valid; c++) {
+                valid = reader.text(stored[p].columns[c], product.columns[c]);
+            }
+            if (!valid || !readTable(reader, stored[p].table, products[p])) return false;
+            productCount++;
+        }
+        indexProductKeys();
+        return true;
+    }
+
+    //======================================================
+    // STRUCTURE: TableLayout
+    // Purpose: Where each LoanOption field is in a table's rows
+    //======================================================
+    struct TableLayout {
+        int position[LOAN_COLUMNS];
+        int fieldsNeeded;
+    };
+
+    //======================================================
+    // STRUCTURE: LoadChunk
+    // Purpose: A newline-aligned piece of a loan table. It parses
+    //          into its own stretch of the option array, one slot
+    //          per line, and is moved up over skipped lines when
+    //          the chunks are merged in file order.
+    //======================================================
+    struct LoadChunk {
+        int product = 0;
+        string_view text;
+        int lines = 0;                          // lines of the file the chunk spans
+        int start = 0;                          // first slot in the option array
+        int kept = 0;                           // rows parsed into it
+        vector<pair<int, string>> errors;       // line within the chunk (from 1), message
+        const LoanOption* embedded = nullptr;   // built-in rows to copy instead of text
+    };
+
+    //======================================================
+    // FUNCTION: missing
+    // Aim: True if no file exists at path (as opposed to one
+    //      that exists but cannot be read)
+    //======================================================
+    static bool missing(const string& path) {
+        error_code error;
+        return !filesystem::exists(path, error) && !error;
+    }
+
+    //======================================================
+    // FUNCTION: embeddedTable
+    // Aim: Built-in loan table for a product's file name, or
+    //      nullptr
+    //======================================================
+    static const EmbeddedTable* embeddedTable(string_view file) {
+        for (const EmbeddedTable& table : EMBEDDED_TABLES) {
+            if (table.file == file) return &table;
+        }
+        return nullptr;
+    }
+
+    //======================================================
+    // FUNCTION: addEmbeddedUtterances
+    // Aim: Appends the built-in utterances whose inputs the
+    //      files did not define, without indexing them (the
+    //      compiled perfect hash finds them), and the built-in
+    //      default response if there is none. The compiled
+    //      inputs are normal under the built-in synonyms only,
+    //      so each is normalized again; one that a synonyms
+    //      file rewrote is kept under its new input in the
+    //      short rekeyed list instead.
+    //======================================================
+    void addEmbeddedUtterances() {
+        reserveUtterances(utteranceCount + EMBEDDED_UTTERANCE_COUNT);
+        embeddedCount = 0;
+        rekeyedCount = 0;
+        string_view inputs[EMBEDDED_UTTERANCE_COUNT];
+        for (int u = 0; u < EMBEDDED_UTTERANCE_COUNT; u++) {
+            inputs[u] = normalizer.apply(EMBEDDED_UTTERANCES[u].input, arena);
+        }
+        for (int u = 0; u < EMBEDDED_UTTERANCE_COUNT; u++) {
+            embeddedRow[u] = -1;
+            string_view input = inputs[u];
+            bool rekeyed = input != EMBEDDED_UTTERANCES[u].input;
+            if (utteranceIndex.find(input) >= 0) continue;
+            int owner = rekeyed ? EMBEDDED_INDEX.find(input) : -1;
+            if (owner >= 0 && inputs[owner] == input) continue;     // a built-in that keeps this input
+            int row = utteranceCount++;
+            utterances[row] = EMBEDDED_UTTERANCES[u];
+            utterances[row].input = input;
+            if (rekeyed) rekeyedRow[rekeyedCount++] = row;
+            else embeddedRow[u] = row;
+            embeddedCount++;
+        }
+        if (defaultResponse.empty()) defaultResponse = EMBEDDED_DEFAULT_RESPONSE;
+    }
+
+    //======================================================
+    // FUNCTION: parseUtterances
+    // Aim: Reads input-response pairs from a mapped file.
+    //      Stores default response if input is '*'.
+    //======================================================
+    void parseUtterances(string_view text) {
+        reserveUtterances(utteranceCount + countLines(text));
+        while (!text.empty()) {
+            string_view line = nextField(text, '\n');
+            string_view response = line;
+            string_view input = nextField(response, '#');
+            if (input.size() == line.size()) continue;     // no '#'
+
+            input = trimView(input);
+            response = trimView(response);
+            if (input == "*") {
+                defaultResponse = response;
+            }
+            else {
+                appendUtterance(normalizer.apply(input, arena), response);
+            }
+        }
+    }
+
+    //======================================================
+    // FUNCTION: openLoanTable
+    // Aim: Maps a product's loan table and reads its header row:
+    //      where each LoanOption field is. Leaves text at the
+    //      first row; false (reported) if the table is unusable.
+    //======================================================
+    bool openLoanTable(const string& filename, const ProductTable& table, string_view& text, TableLayout& layout) {
+        static const int MAX_FIELDS = 32;
+        if (!arena.map(filename, text)) {
+            Screen errors(stderr);
+            errors.color(LIGHT_RED) << "Error: Could not open " << filename << "\n";
+            errors.color(WHITE);
+            return false;
+        }
+
+        string_view header = nextField(text, '\n');
+        for (int c = 0; c < LOAN_COLUMNS; c++) layout.position[c] = c;
+        layout.fieldsNeeded = LOAN_COLUMNS;
+        if (table.product.columns[0].empty()) return true;
+
+        string_view names[MAX_FIELDS];
+        int nameCount = 0;
+        while (!header.empty() && nameCount < MAX_FIELDS) names[nameCount++] = nextField(header, '#');
+
+        layout.fieldsNeeded = 0;
+        for (int c = 0; c < LOAN_COLUMNS; c++) {
+            layout.position[c] = -1;
+            for (int f = 0; f < nameCount && layout.position[c] < 0; f++) {
+                if (sameColumn(names[f], table.product.columns[c])) layout.position[c] = f;
+            }
+            if (layout.position[c] < 0) {
+                Screen errors(stderr);
+                errors.color(LIGHT_RED) << "Error: " << filename << ": no column '" << table.product.columns[c] << "' in the header\n";
+                errors.color(WHITE);
+                return false;
+            }
+            layout.fieldsNeeded = max(layout.fieldsNeeded, layout.position[c] + 1);
+        }
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: splitChunks
+    // Aim: Cuts the rows of a table into pieces of about
+    //      LOAD_CHUNK_BYTES, each ending at a newline
+    //======================================================
+    static void splitChunks(int product, string_view text, vector<LoadChunk>& chunks) {
+        while (!text.empty()) {
+            size_t length = text.size();
+            if (length > LOAD_CHUNK_BYTES) {
+                const char* newline = (const char*)memchr(text.data() + LOAD_CHUNK_BYTES, '\n', length - LOAD_CHUNK_BYTES);
+                if (newline != nullptr) length = (size_t)(newline - text.data()) + 1;
+            }
+            chunks.emplace_back();
+            chunks.back().product = product;
+            chunks.back().text = text.substr(0, length);
+            text.remove_prefix(length);
+        }
+    }
+
+    //======================================================
+    // FUNCTION: parseLoanRows
+    // Aim: Parses the rows of one chunk into rows[]. Bad rows
+    //      are kept as errors and skipped. Touches nothing but
+    //      the chunk and its slots, so chunks parse on any thread.
+    //======================================================
+    static void parseLoanRows(const TableLayout& layout, LoadChunk& chunk, LoanOption* rows) {
+        METRIC_TIME(TIMED_LOAD_TABLE);
+        static const int MAX_FIELDS = 32;
+        string_view text = chunk.text;
+        string_view fields[MAX_FIELDS];
+        int lineNumber = 0;
+
+        while (!text.empty()) {
+            string_view line = nextField(text, '\n');
+            lineNumber++;
+            if (trimView(line).empty()) {
+                continue;
+            }
+
+            for (int f = 0; f < layout.fieldsNeeded; f++) {
+                fields[f] = trimView(nextField(line, '#'));
+            }
+            LoanOption& option = rows[chunk.kept];
+            option.category = fields[layout.position[0]];
+            option.details = fields[layout.position[1]];
+            option.installments = fields[layout.position[2]];
+            option.price = fields[layout.position[3]];
+            option.downPayment = fields[layout.position[4]];
+
+            // Parse the numeric fields once
+            string error;
+            if (!parseCount(option.installments, option.installmentCount) || option.installmentCount <= 0) {
+                error = "invalid installments '" + string(option.installments) + "'";
+            }
+            else if (!Money::parse(option.price, option.priceValue) || option.priceValue <= Money()) {
+                error = "invalid price '" + string(option.price) + "'";
+            }
+            else if (!Money::parse(option.downPayment, option.downPaymentValue)) {
+                error = "invalid down payment '" + string(option.downPayment) + "'";
+            }
+            else if (option.downPaymentValue > option.priceValue) {
+                error = "down payment is more than the price";
+            }
+
+            if (!error.empty()) {
+                chunk.errors.emplace_back(lineNumber, move(error));
+                continue;
+            }
+            chunk.kept++;
+        }
+    }
+
+    //======================================================
+    // FUNCTION: loadText
+    // Aim: Loads the utterances and every loan table from the
+    //      text files on up to threads threads. The files are
+    //      mapped here and cut into newline-aligned chunks. The
+    //      chunks count their lines, then parse straight into
+    //      the option array while another thread reads the
+    //      utterances and builds their indexes. The category
+    //      indexes of the tables are built last, in parallel.
+    //      Missing files fall back to the built-in data; false
+    //      if the utterances file exists but cannot be read.
+    //======================================================
+    bool loadText(const CatalogFiles& files, int threads) {
+        string_view utteranceText;
+        if (!arena.map(files.utterances, utteranceText) && !missing(files.utterances)) {
+            Screen errors(stderr);
+            errors.color(LIGHT_RED) << "Error: Could not open " << files.utterances << "\n";
+            errors.color(WHITE);
+            return false;
+        }
+
+        // Only this thread touches the arena, so map everything first
+        vector<TableLayout> layouts(productCount);
+        vector<LoadChunk> chunks;
+        vector<int> firstChunk(productCount + 1, 0);
+        for (int p = 0; p < productCount; p++) {
+            firstChunk[p] = (int)chunks.size();
+            string file(products[p].product.file);
+            const EmbeddedTable* builtIn = embeddedTable(file);
+            string_view text;
+            if (builtIn != nullptr && missing(file)) {
+                chunks.emplace_back();
+                chunks.back().product = p;
+                chunks.back().embedded = builtIn->rows;
+                chunks.back().lines = builtIn->count;
+            }
+            else if (openLoanTable(file, products[p], text, layouts[p])) {
+                splitChunks(p, text, chunks);
+            }
+        }
+        firstChunk[productCount] = (int)chunks.size();
+
+        // One slot per line; this first pass also pages the files in
+        runTasks((int)chunks.size(), threads, [&](int c) {
+            if (chunks[c].embedded == nullptr) chunks[c].lines = countLines(chunks[c].text);
+        });
+        int slots = loanOptionCount;
+        for (LoadChunk& chunk : chunks) {
+            chunk.start = slots;
+            slots += chunk.lines;
+        }
+        reserveLoanArray(loanOptions, loanOptionCount, loanOptionCapacity, slots);
+
+        runTasks((int)chunks.size() + 1, threads, [&](int task) {
+            if (task == 0) {
+                parseUtterances(utteranceText);
+                addEmbeddedUtterances();
+                buildMatcher();
+            }
+            else if (chunks[task - 1].embedded != nullptr) {
+                LoadChunk& chunk = chunks[task - 1];
+                copy(chunk.embedded, chunk.embedded + chunk.lines, loanOptions + chunk.start);
+                chunk.kept = chunk.lines;
+            }
+            else {
+                LoadChunk& chunk = chunks[task - 1];
+                parseLoanRows(layouts[chunk.product], chunk, loanOptions + chunk.start);
+            }
+        });
+
+        // Merge in file order, closing the gaps left by skipped
+        // lines, and report bad rows by file line (header is 1)
+        int total = loanOptionCount;
+        for (int p = 0; p < productCount; p++) {
+            ProductTable& table = products[p];
+            table.first = total;
+            int lineNumber = 1;
+            for (int c = firstChunk[p]; c < firstChunk[p + 1]; c++) {
+                const LoadChunk& chunk = chunks[c];
+                for (const pair<int, string>& error : chunk.errors) {
+                    Screen errors(stderr);
+                    errors.color(LIGHT_RED) << "Error: " << table.product.file << ":" << lineNumber + error.first <<
+                        ": " << error.second << ", row skipped\n";
+                    errors.color(WHITE);
+                }
+                if (chunk.start != total) {
+                    copy(loanOptions + chunk.start, loanOptions + chunk.start + chunk.kept, loanOptions + total);
+                }
+                lineNumber += chunk.lines;
+                total += chunk.kept;
+            }
+            table.count = total - table.first;
+        }
+        loanOptionCount = total;
+
+        runTasks(productCount, threads, [&](int p) {
+            products[p].categories.build(loanOptions + products[p].first, products[p].count);
+        });
+        return true;
+    }
+
+public:
+    StringArena arena;      // owns the text every Utterance and LoanOption points at
+
+    Utterance* utterances;
+    int utteranceCount;
+    int utteranceCapacity;
+    HashIndex utteranceIndex;       // keyed by normalized input, file utterances only
+    int embeddedRow[EMBEDDED_UTTERANCE_COUNT];  // row of each built-in utterance under its compiled input, or -1
+    int rekeyedRow[EMBEDDED_UTTERANCE_COUNT];   // rows of built-in utterances the synonyms file rewrote
+    int rekeyedCount;
+    int embeddedCount;              // built-in utterances, the last rows
+    TextNormalizer normalizer;      // applied to utterance inputs and to every message
+    IntentMatcher matcher;          // fallback for inputs that are not exact
+    string_view defaultResponse;
+
+    LoanOption* loanOptions;        // every product's options, one slice per product
+    int loanOptionCount;
+    int loanOptionCapacity;
+
+    ProductTable* products;         // indexed by product number
+    int productCount;
+    HashIndex productKeys;          // lowercase chat key -> product number
+    OptionColumns columns;          // numbers of all options, for filter queries
+
+    //======================================================
+    // CONSTRUCTOR: Catalog
+    // Aim: Starts with empty tables
+    //======================================================
+    Catalog() {
+        utteranceCapacity = 10;
+        utteranceCount = 0;
+        utterances = new Utterance[utteranceCapacity];
+        fill(embeddedRow, embeddedRow + EMBEDDED_UTTERANCE_COUNT, -1);
+        rekeyedCount = 0;
+        embeddedCount = 0;
+
+        loanOptionCapacity = 10;
+        loanOptionCount = 0;
+        loanOptions = new LoanOption[loanOptionCapacity];
+
+        products = nullptr;
+        resetProducts(0);
+    }
+
+    //======================================================
+    // DESTRUCTOR: ~Catalog
+    // Aim: Frees the tables (the arena frees the text)
+    //======================================================
+    ~Catalog() {
+        delete[] utterances;
+        delete[] loanOptions;
+        delete[] products;
+    }
+
+    //======================================================
+    // FUNCTION: addUtterance
+    // Aim: Copies one input-response pair into the arena and
+    //      indexes it (used when not loading from a file)
+    //======================================================
+    void addUtterance(const string& input, const string& response) {
+        string_view normalInput = normalizer.apply(input, arena);
+        if (normalInput.data() == input.data()) {
+            normalInput = arena.store(input);
+        }
+        appendUtterance(normalInput, arena.store(response));
+    }
+
+    //======================================================
+    // FUNCTION: loadSynonyms
+    // Aim: Loads the normalizer's synonym table: the optional
+    //      file's lines, then the built-in synonyms
+    //======================================================
+    void loadSynonyms(const string& filename) {
+        string_view text;
+        if (!filename.empty()) arena.map(filename, text);
+        normalizer.build(text, EMBEDDED_SYNONYMS, EMBEDDED_SYNONYM_COUNT);
+    }
+
+    //======================================================
+    // FUNCTION: loadProducts
+    // Aim: Loads the product registry. A missing products file
+    //      (or one without a valid product) means the built-in
+    //      home, car and electric bike products.
+    //======================================================
+    void loadProducts(const string& filename) {
+        string_view text;
+        if (!filename.empty() && arena.map(filename, text)) {
+            parseProducts(text, filename);
+            if (productCount > 0) return;
+            Screen errors(stderr);
+            errors.color(LIGHT_RED) << "Error: " << filename << " declares no products, using the built-in ones\n";
+            errors.color(WHITE);
+        }
+        resetProducts(DEFAULT_PRODUCT_COUNT);
+        for (int p = 0; p < DEFAULT_PRODUCT_COUNT; p++) {
+            products[productCount++].product = DEFAULT_PRODUCTS[p];
+        }
+        indexProductKeys();
+    }
+
+    //======================================================
+    // FUNCTION: findProduct
+    // Aim: Product picked by a lowercase chat key, or -1
+    //======================================================
+    int findProduct(string_view lowerKey) const {
+        return productKeys.find(lowerKey);
+    }
+
+    //======================================================
+    // FUNCTION: findUtterance
+    // Aim: Row of the utterance with this normalized input: a
+    //      file's first, then a built-in one; -1 if neither
+    //======================================================
+    int findUtterance(string_view normalInput) const {
+        int row = utteranceIndex.find(normalInput);
+        if (row >= 0) return row;
+        int u = EMBEDDED_INDEX.find(normalInput);
+        if (u >= 0 && embeddedRow[u] >= 0) return embeddedRow[u];
+        for (int k = 0; k < rekeyedCount; k++) {
+            if (utterances[rekeyedRow[k]].input == normalInput) return rekeyedRow[k];
+        }
+        return -1;
+    }
+
+    //======================================================
+    // FUNCTION: optionsOf
+    // Aim: First option of a product's slice
+    //======================================================
+    const LoanOption* optionsOf(int product) const {
+        return loanOptions + products[product].first;
+    }
+
+    //======================================================
+    // FUNCTION: saveImage
+    // Aim: Writes this catalog, loaded from files, as a binary
+    //      image
+    //======================================================
+    bool saveImage(const string& filename, const CatalogFiles& files) const {
+        ImageWriter writer;
+        ImageHeader header = {};
+        header.sources = presentSources(files);
+
+        int fileUtterances = utteranceCount - embeddedCount;    // the built-in ones are added on load
+        vector<ImageString> inputs(fileUtterances), responses(fileUtterances);
+        for (int i = 0; i < fileUtterances; i++) {
+            inputs[i] = writer.addString(utterances[i].input);
+            responses[i] = writer.addString(utterances[i].response);
+        }
+        header.inputs = writer.append(inputs.data(), inputs.size());
+        header.responses = writer.append(responses.data(), responses.size());
+        header.utteranceKeys = writer.addHash(utteranceIndex);
+        header.defaultResponse = writer.addString(defaultResponse);
+
+        vector<ImageProduct> stored(productCount);
+        for (int p = 0; p < productCount; p++) {
+            const LoanProduct& product = products[p].product;
+            stored[p].keys = writer.addString(product.keys);
+            stored[p].name = writer.addString(product.name);
+            stored[p].file = writer.addString(product.file);
+            for (int c = 0; c < LOAN_COLUMNS; c++) {
+                stored[p].columns[c] = writer.addString(product.columns[c]);
+            }
+            stored[p].unavailable = writer.addString(product.unavailable);
+            writeTable(writer, optionsOf(p), products[p].count, products[p].categories, stored[p].table);
+        }
+        header.products = writer.append(stored.data(), stored.size());
+
+        string image;
+        if (!writer.finish(header, image)) return false;
+        ofstream file(filename, ios::binary | ios::trunc);
+        file.write(image.data(), (streamsize)image.size());
+        return (bool)file;
+    }
+
+    //======================================================
+    // FUNCTION: loadImage
+    // Aim: Opens a binary image with mmap. Strings stay in the
+    //      mapping and the hash slots are searched in place;
+    //      only the record arrays are filled. Returns false,
+    //      leaving the catalog empty, if the image is invalid.
+    //======================================================
+    bool loadImage(const string& filename) {
+        string_view bytes;
+        if (!arena.map(filename, bytes)) return false;
+
+        ImageHeader header;
+        if (bytes.size() < sizeof(header)) return false;
+        memcpy(&header, bytes.data(), sizeof(header));
+        if (memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+            header.version != IMAGE_VERSION || header.byteOrder != IMAGE_BYTE_ORDER ||
+            header.fileSize != bytes.size() ||
+            header.checksum != imageChecksum(bytes.substr(sizeof(header)))) {
+            return false;
+        }
+
+        ImageReader reader(bytes);
+        const char* pool = reader.array<char>(header.pool);
+        if (pool == nullptr) return false;
+        reader.setPool(string_view(pool, header.pool.count));
+
+        bool valid = readUtterances(reader, header) && readProducts(reader, header);
+        if (!valid) {
+            utteranceCount = 0;
+            utteranceIndex.clear();
+            defaultResponse = string_view();
+            resetProducts(0);
+        }
+        return valid;
+    }
+
+    //======================================================
+    // FUNCTION: load
+    // Aim: Loads all files into this catalog. No file is
+    //      required; the built-in data fills in for missing
+    //      ones. A valid image that is newer than every text
+    //      file is used instead of them.
+    //      Text files parse on threads threads (0: one per core).
+    //======================================================
+    bool load(const CatalogFiles& files, int threads = 0) {
+        METRIC_TIME(TIMED_LOAD_CATALOG);
+        loadProducts(files.products);
+        loadSynonyms(files.synonyms);
+        if (imageIsCurrent(files)) {
+            if (loadImage(files.image)) {
+                addEmbeddedUtterances();
+                buildMatcher();
+                return true;
+            }
+            Screen errors(stderr);
+            errors.color(LIGHT_RED) << "Error: " << files.image << " is not a valid catalog image, reading text files\n";
+            errors.color(WHITE);
+            loadProducts(files.products);
+        }
+        return loadText(files, threads > 0 ? threads : max(1, (int)thread::hardware_concurrency()));
+    }
+
+    //======================================================
+    // FUNCTION: buildMatcher
+    // Aim: (Re)builds the fuzzy matcher over all utterances.
+    //      load() does this; call it after addUtterance.
+    //======================================================
+    void buildMatcher() {
+        matcher.build(utterances, utteranceCount);
+    }
+
+    //======================================================
+    // FUNCTION: buildQuotes
+    // Aim: Precomputes the quote panels of all loan tables
+    //      and the option columns filter queries scan
+    //======================================================
+    void buildQuotes(double annualRate, DigitGrouping grouping) {
+        for (int p = 0; p < productCount; p++) {
+            products[p].quotes.build(optionsOf(p), products[p].count, annualRate, grouping);
+        }
+        columns.build(loanOptions, loanOptionCount, annualRate);
+    }
+
+    //======================================================
+    // FUNCTION: filter
+    // Aim: Runs an affordability query over one product's
+    //      slice of the option columns, or over all of them
+    //======================================================
+    void filter(const FilterQuery& query, FilterResult& result) const {
+        METRIC_COUNT(METRIC_FILTERS);
+        METRIC_TIME(TIMED_FILTER);
+        if (query.product >= 0 && query.product < productCount) {
+            const ProductTable& table = products[query.product];
+            columns.filter(query, table.first, table.first + table.count, result);
+        }
+        else {
+            columns.filter(query, 0, loanOptionCount, result);
+        }
+    }
+
+    //======================================================
+    // FUNCTION: productOfRow
+    // Aim: Product whose slice holds an option row, or -1
+    //======================================================
+    int productOfRow(int row) const {
+        for (int p = 0; p < productCount; p++) {
+            if (row >= products[p].first && row < products[p].first + products[p].count) return p;
+        }
+        return -1;
+    }
+};
+
+//======================================================
+// CLASS: TurnArena
+// Purpose: Scratch memory for one conversation turn. Text is
+//          bump-allocated from chunks that are kept when the
+//          arena is reset, so once the chunks have grown to fit
+//          a turn, handling a message allocates nothing.
+//          Call reset() at the start of every turn.
+//======================================================
+class TurnArena {
+private:
+    vector<unique_ptr<char[]>> chunks;
+    vector<size_t> chunkSizes;
+    size_t current;         // chunk being filled
+    size_t used;            // bytes used in it
+
+    TurnArena(const TurnArena&) = delete;
+    TurnArena& operator=(const TurnArena&) = delete;
+
+public:
+    TurnArena() : current(0), used(0) {}
+
+    //======================================================
+    // FUNCTION: allocate
+    // Aim: size bytes valid until the next reset()
+    //======================================================
+    char* allocate(size_t size) {
+        while (current < chunks.size() && used + size > chunkSizes[current]) {
+            current++;
+            used = 0;
+        }
+        if (current == chunks.size()) {
+            size_t chunkSize = chunkSizes.empty() ? 4096 : chunkSizes.back() * 2;
+            while (chunkSize < size) chunkSize *= 2;
+            chunks.push_back(unique_ptr<char[]>(new char[chunkSize]));
+            chunkSizes.push_back(chunkSize);
+            used = 0;
+        }
+        char* result = chunks[current].get() + used;
+        used += size;
+        return result;
+    }
+
+    //======================================================
+    // FUNCTION: reset
+    // Aim: Frees everything at once; the chunks are kept
+    //======================================================
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+    //======================================================
+    // FUNCTION: lower
+    // Aim: ASCII-lowercased view of text, copied only if it
+    //      has an uppercase letter
+    //======================================================
+    string_view lower(string_view text) {
+        size_t i = 0;
+        while (i < text.size() && !(text[i] >= 'A' && text[i] <= 'Z')) i++;
+        if (i == text.size()) return text;
+
+        char* copy = allocate(text.size());
+        for (size_t j = 0; j < text.size(); j++) {
+            char c = text[j];
+            copy[j] = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+        }
+        return string_view(copy, text.size());
+    }
+};
+
+//======================================================
+// CLASS: TurnText
+// Purpose: Text built up in a TurnArena (replies, prompts),
+//          used like a string stream. Growing moves it to a
+//          block twice the size in the same arena.
+//======================================================
+class TurnText {
+private:
+    TurnArena& arena;
+    char* data;
+    size_t length;
+    size_t capacity;
+
+    void reserve(size_t needed) {
+        if (needed <= capacity) return;
+        size_t grown = capacity < 256 ? 256 : capacity * 2;
+        while (grown < needed) grown *= 2;
+        char* moved = arena.allocate(grown);
+        if (length > 0) memcpy(moved, data, length);
+        data = moved;
+        capacity = grown;
+    }
+
+public:
+    explicit TurnText(TurnArena& owner) : arena(owner), data(nullptr), length(0), capacity(0) {}
+
+    TurnText& operator<<(string_view text) {
+        reserve(length + text.size());
+        if (!text.empty()) memcpy(data + length, text.data(), text.size());
+        length += text.size();
+        return *this;
+    }
+    TurnText& operator<<(const char* text) { return *this << string_view(text); }
+    TurnText& operator<<(char c) { return *this << string_view(&c, 1); }
+    TurnText& operator<<(int value) {
+        char digits[16];
+        int size = snprintf(digits, sizeof(digits), "%d", value);
+        return *this << string_view(digits, size);
+    }
+
+    void clear() { length = 0; }
+    bool empty() const { return length == 0; }
+    string_view view() const { return string_view(data, length); }
+};
+
+//======================================================
+// FUNCTION: sameText
+// Aim: ASCII case-insensitive comparison against a lowercase
+//      word, without copying the input
+//======================================================
+bool sameText(string_view text, string_view lowerWord) {
+    if (text.size() != lowerWord.size()) return false;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c >= 'A' && c <= 'Z') c = (char)(c + 32);
+        if (c != lowerWord[i]) return false;
+    }
+    return true;
+}
+
+//======================================================
+// ENUM: FilterField
+// Purpose: The limit a word of a filter query names
+//======================================================
+enum FilterField {
+    FIELD_NONE,
+    FIELD_DOWN,
+    FIELD_MONTHLY,
+    FIELD_PRICE,
+    FIELD_TERM
+};
+
+//======================================================
+// FUNCTION: filterField
+// Aim: Limit named by a lowercase query word
+//======================================================
+FilterField filterField(string_view word) {
+    if (word == "down" || word == "downpayment" || word == "deposit") return FIELD_DOWN;
+    if (word == "monthly" || word == "installment" || word == "installments" || word == "emi") return FIELD_MONTHLY;
+    if (word == "price") return FIELD_PRICE;
+    if (word == "term" || word == "months" || word == "month") return FIELD_TERM;
+    return FIELD_NONE;
+}
+
+//======================================================
+// FUNCTION: filterUnit
+// Aim: Multiplier of an amount unit (k, lakh, m, crore), or
+//      0 if word is not a unit
+//======================================================
+double filterUnit(string_view word) {
+    if (word == "k" || word == "thousand") return 1e3;
+    if (word == "lakh" || word == "lakhs" || word == "lac" || word == "lacs") return 1e5;
+    if (word == "m" || word == "mn" || word == "million") return 1e6;
+    if (word == "crore" || word == "crores" || word == "cr") return 1e7;
+    return 0;
+}
+
+//======================================================
+// FUNCTION: parseFilterQuery
+// Aim: Reads an affordability query such as "home down 20
+//      lakh monthly <= 150k 60 months" into query. A limit is
+//      a word (down, monthly, price, term) and an amount, in
+//      either order; amounts may carry a unit. Product keys
+//      and name words pick one product; other words are
+//      ignored. Returns false with the reason in error.
+//======================================================
+bool parseFilterQuery(string_view lowerText, const Catalog& data, FilterQuery& query, TurnText& error) {
+    const int maxTokens = 32;
+    string_view tokens[maxTokens];
+    int tokenCount = 0;
+    size_t i = 0;
+    while (i < lowerText.size()) {
+        auto separator = [](char c) { return c == ' ' || c == '\t' || c == '<' || c == '=' || c == ':' || c == ';'; };
+        while (i < lowerText.size() && separator(lowerText[i])) i++;
+        size_t start = i;
+        while (i < lowerText.size() && !separator(lowerText[i])) i++;
+        string_view token = lowerText.substr(start, i - start);
+        while (!token.empty() && token.back() == ',') token.remove_suffix(1);
+        if (token.empty()) continue;
+        if (tokenCount == maxTokens) {
+            error << "That query is too long. Please use at most " << maxTokens << " words.";
+            return false;
+        }
+        tokens[tokenCount++] = token;
+    }
+
+    FilterField pending = FIELD_NONE;   // a limit word waiting for its amount
+    string_view pendingWord;
+    double waiting = 0;                 // an amount waiting for its limit word
+    string_view waitingText;
+    bool limited = false;
+
+    auto assign = [&](FilterField field, double amount, string_view text) {
+        if (field == FIELD_TERM) {
+            if (amount != floor(amount) || amount < 1 || amount > MAX_INSTALLMENTS) {
+                error << "The term must be a whole number of months from 1 to " << MAX_INSTALLMENTS << ", not " << text << ".";
+                return false;
+            }
+            query.months = (int)amount;
+        }
+        else if (field == FIELD_DOWN) query.maxDownPayment = amount;
+        else if (field == FIELD_MONTHLY) query.maxMonthly = amount;
+        else query.maxPrice = amount;
+        limited = true;
+        return true;
+    };
+
+    for (int t = 0; t < tokenCount; t++) {
+        string_view token = tokens[t];
+        if ((token[0] >= '0' && token[0] <= '9') || token[0] == '.') {
+            double amount = 0, scale = 1;
+            bool fraction = false;
+            size_t k = 0;
+            for (; k < token.size(); k++) {
+                char c = token[k];
+                if (c >= '0' && c <= '9') {
+                    if (fraction) scale /= 10;
+                    amount = amount * 10 + (c - '0');
+                }
+                else if (c == '.' && !fraction) fraction = true;
+                else if (c != ',' || fraction) break;
+            }
+            amount *= scale;
+
+            string_view suffix = token.substr(k);
+            double unit = suffix.empty() ? 1 : filterUnit(suffix);
+            if (unit == 0) {
+                error << "I did not understand \"" << token << "\". Amounts look like 150000, 150k or 20 lakh.";
+                return false;
+            }
+            if (suffix.empty() && t + 1 < tokenCount && filterUnit(tokens[t + 1]) > 0) {
+                unit = filterUnit(tokens[++t]);
+            }
+            amount *= unit;
+
+            // "60 months" names its limit after the amount
+            if (t + 1 < tokenCount && filterField(tokens[t + 1]) == FIELD_TERM && tokens[t + 1] != "term") {
+                t++;
+                if (!assign(FIELD_TERM, amount, token)) return false;
+                if (pending == FIELD_TERM) pending = FIELD_NONE;
+            }
+            else if (pending != FIELD_NONE) {
+                if (!assign(pending, amount, token)) return false;
+                pending = FIELD_NONE;
+            }
+            else if (!waitingText.empty()) {
+                error << "Which limit is " << waitingText << " for? Put down, monthly, price or months next to it.";
+                return false;
+            }
+            else {
+                waiting = amount;
+                waitingText = token;
+            }
+            continue;
+        }
+
+        FilterField field = filterField(token);
+        if (field != FIELD_NONE) {
+            if (!waitingText.empty()) {
+                if (!assign(field, waiting, waitingText)) return false;
+                waitingText = string_view();
+            }
+            else {
+                pending = field;
+                pendingWord = token;
+            }
+            continue;
+        }
+
+        if (token == "all" || token == "any") {
+            query.product = -1;
+            continue;
+        }
+        int product = data.findProduct(token);
+        for (int p = 0; p < data.productCount && product < 0; p++) {
+            string_view name = data.products[p].product.name;
+            while (!name.empty() && product < 0) {
+                size_t space = name.find(' ');
+                if (sameText(name.substr(0, space), token)) product = p;
+                name = space == string_view::npos ? string_view() : name.substr(space + 1);
+            }
+        }
+        if (product >= 0) query.product = product;
+    }
+
+    if (!waitingText.empty()) {
+        error << "Which limit is " << waitingText << " for? Put down, monthly, price or months next to it.";
+        return false;
+    }
+    if (pending != FIELD_NONE) {
+        error << "Please give an amount after \"" << pendingWord << "\".";
+        return false;
+    }
+    if (!limited && query.product < 0) {
+        error << "Please give at least one limit, for example: home down 20 lakh monthly 150k 60 months.";
+        return false;
+    }
+    return true;
+}
+
+//======================================================
+// CLASS: LoanApplicationSystem
+// Purpose: Handles chatbot interaction and home loan information
+//======================================================
+class LoanApplicationSystem {
+private:
+    typedef SnapshotPointer<Catalog>::Reader CatalogReader;
+
+    mutable SnapshotPointer<Catalog> catalog;   // readers pin it, reloads swap it
+    CatalogFiles files;
+    thread watcher;
+    mutex watcherLock;
+    condition_variable watcherWake;
+    bool watcherStop;
+
+    string chatbotName;
+    double annualRate;      // percent per year, 0 = interest free
+    DigitGrouping grouping; // how amounts are grouped on screen
+    Screen screen;
+    TurnArena consoleArena;             // text of the current console turn
+    string inputLine;                   // console input, reused between reads
+
+    //======================================================
+    // FUNCTION: trim
+    // Aim: Removes whitespace (spaces, tabs, newlines) from
+    //      the beginning and end of a string, without a copy.
+    //======================================================
+    string_view trim(string_view str) const {
+        return trimView(str);
+    }
+
+    //======================================================
+    // FUNCTION: toLower
+    // Aim: Converts all uppercase characters in a string
+    //      to lowercase for case-insensitive comparison.
+    //======================================================
+    string toLower(string_view text) const {
+        string str(text);
+        for (size_t i = 0; i < str.length(); i++) {
+            if (str[i] >= 'A' && str[i] <= 'Z') {
+                str[i] = str[i] + 32;
+            }
+        }
+        return str;
+    }
+    //======================================================
+    // FUNCTION: isValidNumber
+    // Aim: Checks if string contains only digits
+    //======================================================
+    bool isValidNumber(string_view str) const {
+    if (str.empty()) return false;
+    for (size_t i = 0; i < str.length(); i++) {
+        if (str[i] < '0' || str[i] > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+    //======================================================
+    // FUNCTION: stringToInt
+    // Aim: Converts string to integer
+    //======================================================
+    int stringToInt(string_view str) const {
+    int value = 0;
+    for (size_t i = 0; i < str.length() && str[i] >= '0' && str[i] <= '9'; i++) {
+        if (value > 100000000) break;   // large enough for any menu choice or term
+        value = value * 10 + (str[i] - '0');
+    }
+    return value;
+}
+
+    //======================================================
+    // FUNCTION: formatNumber
+    // Aim: Formats number with commas for better readability
+    //======================================================
+    NumberText formatNumber(double num) const {
+        return formatAmount(num, grouping);
+    }
+
+    NumberText formatNumber(Money amount) const {
+        return formatPaisa(amount.paisa, grouping);
+    }
+
+    //======================================================
+    // FUNCTION: calculateMonthlyInstallment
+    // Aim: Calculates monthly installment amount on
+    //      (Price - Down Payment) at the configured annual rate
+    //======================================================
+    Money calculateMonthlyInstallment(Money price, Money downPayment, int installments) const {
+        return ScheduleCursor(price - downPayment, annualRate, installments).monthly();
+    }
+
+    //======================================================
+    // FUNCTION: readLine
+    // Aim: Flushes the pending screen, then reads one line
+    //======================================================
+    bool readLine(string& line) {
+        screen.flush();
+        return (bool)getline(cin, line);
+    }
+
+    //======================================================
+    // FUNCTION: productTable
+    // Aim: Maps a product number to its option slice,
+    //      category index and name in a catalog snapshot
+    //======================================================
+    static void productTable(const Catalog& data, int product, const LoanOption*& options, const CategoryIndex*& categories,
+        const QuoteTable*& quotes, int& count, string_view& loanType) {
+        if (product >= 0 && product < data.productCount) {
+            const ProductTable& table = data.products[product];
+            options = data.optionsOf(product); categories = &table.categories; quotes = &table.quotes; count = table.count; loanType = table.product.name;
+        }
+        else {
+            options = nullptr; categories = nullptr; quotes = nullptr; count = 0; loanType = "";
+        }
+    }
+
+    //======================================================
+    // FUNCTION: quoteText
+    // Aim: Formatted monthly payment of an option row for a
+    //      term: a lookup in the quote table when it has the
+    //      term, otherwise computed into scratch
+    //======================================================
+    string_view quoteText(const QuoteTable& quotes, const LoanOption& loan, int row, int months, NumberText& scratch) const {
+        const QuotePanel* panel = quotes.find(row, annualRate, grouping);
+        int slot = panel ? QuoteTable::slotFor(*panel, months) : -1;
+        if (slot >= 0) {
+            return quotes.amountText(*panel, slot);
+        }
+        scratch = formatNumber(calculateMonthlyInstallment(loan.priceValue, loan.downPaymentValue, months));
+        return scratch;
+    }
+
+    //======================================================
+    // FUNCTION: lookupResponse
+    // Aim: Response for an already normalized input: an exact
+    //      hash hit first, then the fuzzy matcher, then the
+    //      default response
+    //======================================================
+    static string_view lookupResponse(const Catalog& data, string_view normalInput) {
+        METRIC_TIME(TIMED_MATCH);
+        int index = data.findUtterance(normalInput);
+        if (index >= 0) {
+            METRIC_COUNT(METRIC_EXACT_HITS);
+            return data.utterances[index].response;
+        }
+        index = data.matcher.match(normalInput);
+        if (index >= 0) {
+            METRIC_COUNT(METRIC_FUZZY_HITS);
+            return data.utterances[index].response;
+        }
+        METRIC_COUNT(METRIC_DEFAULT_RESPONSES);
+        return data.defaultResponse;
+    }
+
+    //======================================================
+    // FUNCTION: fileStamp
+    // Aim: Last write time of a file, or the minimum if it
+    //      does not exist
+    //======================================================
+    static filesystem::file_time_type fileStamp(const string& path) {
+        error_code error;
+        filesystem::file_time_type stamp = filesystem::last_write_time(path, error);
+        return error ? filesystem::file_time_type::min() : stamp;
+    }
+
+    //======================================================
+    // FUNCTION: parseSelection
+    // Aim: Reads a menu number from min to max. Returns the
+    //      number, or -1 with the error in error.
+    //======================================================
+    int parseSelection(string_view input, int min, int max, TurnText& error) const {
+        if (input.empty()) {
+            error << "Input cannot be empty. Please try again.";
+            return -1;
+        }
+        if (!isValidNumber(input)) {
+            error << "Invalid input! Please enter a number between " << min << " and " << max << ".";
+            return -1;
+        }
+        int value = stringToInt(input);
+        if (value < min || value > max) {
+            error << "Invalid option! Please enter a number between " << min << " and " << max << ".";
+            return -1;
+        }
+        return value;
+    }
+
+    //======================================================
+    // FUNCTION: filterRequest
+    // Aim: True for the filter intent: "f" alone, or "f"
+    //      followed by the query itself, returned in queryText
+    //======================================================
+    static bool filterRequest(string_view lowerInput, string_view& queryText) {
+        if (lowerInput.empty() || lowerInput[0] != 'f') return false;
+        if (lowerInput.size() > 1 && lowerInput[1] != ' ') return false;
+        queryText = trimView(lowerInput.substr(1));
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: describeFilterResult
+    // Aim: Plain-text answer to a filter query: the limits as
+    //      understood, then the cheapest matches by total cost
+    //======================================================
+    void describeFilterResult(const Catalog& data, const FilterQuery& query, const FilterResult& result, TurnText& text) const {
+        text << "Searching " << (query.product >= 0 ? data.products[query.product].product.name : "all") << " loan options";
+        const char* joiner = " with ";
+        if (query.maxDownPayment != numeric_limits<double>::infinity()) {
+            text << joiner << "down payment up to Rs. " << formatNumber(query.maxDownPayment);
+            joiner = ", ";
+        }
+        if (query.maxMonthly != numeric_limits<double>::infinity()) {
+            text << joiner << "monthly installment up to Rs. " << formatNumber(query.maxMonthly);
+            joiner = ", ";
+        }
+        if (query.maxPrice != numeric_limits<double>::infinity()) {
+            text << joiner << "price up to Rs. " << formatNumber(query.maxPrice);
+            joiner = ", ";
+        }
+        text << (joiner[0] == ',' ? "," : "");
+        if (query.months > 0) text << " over " << query.months << " months.\n";
+        else text << " over each option's suggested term.\n";
+
+        if (result.matches == 0) {
+            text << "No option fits these limits. A longer term or a larger down payment may help.\n";
+            return;
+        }
+        text << "Found " << formatNumber(result.matches) << " of " << formatNumber(result.scanned) << " options";
+        if (result.matches > result.shown) text << ". The " << result.shown << " cheapest by total cost:\n";
+        else text << ", cheapest total cost first:\n";
+
+        for (int k = 0; k < result.shown; k++) {
+            const LoanOption& option = data.loanOptions[result.rows[k]];
+            int product = data.productOfRow(result.rows[k]);
+            text << "\n" << (k + 1) << ". " << (product >= 0 ? data.products[product].product.name : "") <<
+                " - " << option.category << " - " << option.details << "\n";
+            text << "   Price: Rs. " << formatNumber(option.priceValue) <<
+                ", Down Payment: Rs. " << formatNumber(option.downPaymentValue) << "\n";
+            ScheduleCursor plan(option.priceValue - option.downPaymentValue, annualRate, result.months[k]);
+            text << "   Monthly Installment: Rs. " << formatNumber(plan.monthly()) <<
+                " for " << result.months[k] << " months\n";
+            text << "   Total Cost: Rs. " << formatNumber(option.downPaymentValue + plan.totalPaid()) << "\n";
+        }
+    }
+
+    //======================================================
+    // STRUCTURE: DialogTurn
+    // Purpose: What one step of the dialog works with: the
+    //          message, the pinned catalog snapshot and the
+    //          tables of the session's product
+    //======================================================
+    struct DialogTurn {
+        const Catalog& data;
+        TurnArena& arena;
+        string_view input;
+        string_view lowerInput;
+        string_view normalInput;    // what utterances are matched against
+        const LoanOption* options = nullptr;
+        const CategoryIndex* categories = nullptr;
+        const QuoteTable* quotes = nullptr;
+        int count = 0;
+        string_view loanType = {};
+        bool again = false;     // the answer was rejected, the same question stands
+    };
+
+    //======================================================
+    // FUNCTION: stateFits
+    // Aim: True if the catalog still has what the stage needs.
+    //      A reload may have shrunk the tables under a session,
+    //      and a restored session may come from another catalog.
+    //======================================================
+    static bool stateFits(const SessionState& state, const DialogTurn& turn, DialogNeeds needs) {
+        if (needs == NEEDS_NOTHING) return true;
+        if (turn.count == 0) return false;
+        if (needs >= NEEDS_CATEGORY && (state.category < 0 || state.category >= turn.categories->categoryCount())) return false;
+        if (needs >= NEEDS_OPTION && (state.optionIndex < 0 || state.optionIndex >= turn.count)) return false;
+        if (needs >= NEEDS_PLAN && (state.installments < 1 || state.installments > MAX_INSTALLMENTS ||
+            state.planMonth < 0 || state.planMonth >= state.installments)) return false;
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: numberInput
+    // Aim: Non-blocking counterpart of the old retry loop: the
+    //      number in the message, or -1 after reporting why it
+    //      was rejected
+    //======================================================
+    template <class Out>
+    int numberInput(DialogTurn& turn, int min, int max, Out& out) const {
+        TurnText error(turn.arena);
+        int value = parseSelection(turn.input, min, max, error);
+        if (value < 0) {
+            out.inputError(error.view());
+            turn.again = true;
+        }
+        return value;
+    }
+
+    //======================================================
+    // FUNCTION: showPlan
+    // Aim: Shows the installment plan from state.planMonth on.
+    //      With pageRows > 0, stops after a page in
+    //      STAGE_PLAN_PAGE; otherwise (or once showing is false)
+    //      ends with the total in STAGE_CONTINUE.
+    //======================================================
+    template <class Out>
+    void showPlan(const LoanOption& loan, string_view loanType, SessionState& state, int pageRows, bool showing, Out& out) const {
+        METRIC_TIME(TIMED_PLAN);
+        ScheduleCursor cursor(loan.priceValue - loan.downPaymentValue, annualRate, state.installments);
+        if (state.planMonth == 0) out.planHeader(loan, loanType, cursor);
+        cursor.seek(state.planMonth);
+
+        AmortizationRow row;
+        while (showing && cursor.next(row)) {
+            out.planRow(row);
+            if (pageRows > 0 && row.month % pageRows == 0 && !cursor.done()) {
+                state.planMonth = row.month;
+                state.stage = STAGE_PLAN_PAGE;
+                return;
+            }
+        }
+
+        out.planTotal(loan.downPaymentValue + cursor.totalPaid());
+        state.planMonth = 0;
+        state.stage = STAGE_CONTINUE;
+    }
+
+    //======================================================
+    // FUNCTION: answerFilter
+    // Aim: Runs a filter query: the matches, or the parse
+    //      error and the filter stage again
+    //======================================================
+    template <class Out>
+    void answerFilter(DialogTurn& turn, string_view lowerQuery, SessionState& state, Out& out) const {
+        FilterQuery query;
+        TurnText text(turn.arena);
+        if (!parseFilterQuery(lowerQuery, turn.data, query, text)) {
+            out.filterError(text.view());
+            state.stage = STAGE_FILTER;
+            return;
+        }
+        FilterResult result;
+        turn.data.filter(query, result);
+        describeFilterResult(turn.data, query, result, text);
+        out.filterResult(text.view());
+        state.stage = STAGE_CONTINUE;
+    }
+
+    //======================================================
+    // FUNCTION: onChat
+    // Aim: Free chat: answers the message, then moves on to the
+    //      categories of a product it names or to the filter
+    //======================================================
+    template <class Out>
+    void onChat(SessionState& state, DialogTurn& turn, Out& out) const {
+        if (turn.input.empty()) return;
+        int product = turn.data.findProduct(turn.lowerInput);
+        string_view filterText;
+        if (product < 0 && filterRequest(turn.lowerInput, filterText)) {
+            out.response(lookupResponse(turn.data, "f"));
+            state.stage = STAGE_FILTER;
+            if (!filterText.empty()) answerFilter(turn, filterText, state, out);
+            return;
+        }
+
+        out.response(lookupResponse(turn.data, turn.normalInput));
+        if (product < 0) return;
+
+        state.product = product;
+        productTable(turn.data, product, turn.options, turn.categories, turn.quotes, turn.count, turn.loanType);
+        if (turn.count == 0) {
+            out.unavailable(turn.data.products[product].product.unavailable);
+            state.stage = STAGE_CONTINUE;
+            return;
+        }
+        out.categoryList(turn.loanType, *turn.categories);
+        state.stage = STAGE_CATEGORY;
+    }
+
+    //======================================================
+    // FUNCTION: onCategory
+    // Aim: Category number: lists the options of the category
+    //======================================================
+    template <class Out>
+    void onCategory(SessionState& state, DialogTurn& turn, Out& out) const {
+        int selection = numberInput(turn, 1, turn.categories->categoryCount(), out);
+        if (selection < 0) return;
+
+        state.category = selection - 1;
+        METRIC_CATEGORY_PICK(state.product, state.category);
+        METRIC_TIME(TIMED_SELECTION);
+        out.optionList(turn.options, *turn.categories, state.category, turn.loanType);
+        state.stage = STAGE_OPTION;
+    }
+
+    //======================================================
+    // FUNCTION: onOption
+    // Aim: Option number: quotes the suggested and common
+    //      terms, or skips ahead on 0
+    //======================================================
+    template <class Out>
+    void onOption(SessionState& state, DialogTurn& turn, Out& out) const {
+        int selection = numberInput(turn, 0, turn.categories->optionCount(state.category), out);
+        if (selection < 0) return;
+        if (selection == 0) {
+            state.stage = STAGE_CONTINUE;
+            return;
+        }
+
+        METRIC_COUNT(METRIC_OPTION_SELECTIONS);
+        state.optionIndex = turn.categories->optionRow(state.category, selection - 1);
+        out.termChoices(*turn.quotes, turn.options[state.optionIndex], state.optionIndex);
+        state.stage = STAGE_TERM;
+    }
+
+    //======================================================
+    // FUNCTION: onTerm
+    // Aim: Number of months: quotes the monthly payment
+    //======================================================
+    template <class Out>
+    void onTerm(SessionState& state, DialogTurn& turn, Out& out) const {
+        int months = numberInput(turn, 1, MAX_INSTALLMENTS, out);
+        if (months < 0) return;
+
+        state.installments = months;
+        out.monthlyQuote(*turn.quotes, turn.options[state.optionIndex], state.optionIndex, months);
+        state.stage = STAGE_PLAN_CONFIRM;
+    }
+
+    //======================================================
+    // FUNCTION: onPlanConfirm
+    // Aim: Y shows the plan from its first month; anything
+    //      else skips it
+    //======================================================
+    template <class Out>
+    void onPlanConfirm(SessionState& state, DialogTurn& turn, Out& out) const {
+        if (turn.lowerInput != "y" && turn.lowerInput != "yes") {
+            state.stage = STAGE_CONTINUE;
+            return;
+        }
+        METRIC_COUNT(METRIC_PLANS);
+        state.planMonth = 0;
+        showPlan(turn.options[state.optionIndex], turn.loanType, state, out.planPageRows(), true, out);
+    }
+
+    //======================================================
+    // FUNCTION: onPlanPage
+    // Aim: Next page of the plan, or X to skip to the total
+    //======================================================
+    template <class Out>
+    void onPlanPage(SessionState& state, DialogTurn& turn, Out& out) const {
+        showPlan(turn.options[state.optionIndex], turn.loanType, state, out.planPageRows(), turn.lowerInput != "x", out);
+    }
+
+    //======================================================
+    // FUNCTION: onFilter
+    // Aim: The limits of a filter query
+    //======================================================
+    template <class Out>
+    void onFilter(SessionState& state, DialogTurn& turn, Out& out) const {
+        answerFilter(turn, turn.lowerInput, state, out);
+    }
+
+    //======================================================
+    // FUNCTION: onContinue
+    // Aim: Any answer but X goes back to free chat
+    //======================================================
+    template <class Out>
+    void onContinue(SessionState& state, DialogTurn&, Out&) const {
+        state = SessionState();
+    }
+
+    //======================================================
+    // FUNCTION: onEnded
+    // Aim: A message after the goodbye starts over with the
+    //      greeting
+    //======================================================
+    template <class Out>
+    void onEnded(SessionState& state, DialogTurn& turn, Out& out) const {
+        state = SessionState();
+        out.greeting(lookupResponse(turn.data, "hi"));
+    }
+
+    //======================================================
+    // FUNCTION: prompt
+    // Aim: Asks for the input of the stage the dialog is now
+    //      in, with the numbers its prompt text refers to
+    //======================================================
+    template <class Out>
+    void prompt(const SessionState& state, const DialogTurn& turn, Out& out) const {
+        int first = 0, second = 0;
+        switch (state.stage) {
+        case STAGE_CATEGORY: first = turn.categories->categoryCount(); break;
+        case STAGE_OPTION: first = turn.categories->optionCount(state.category); break;
+        case STAGE_TERM: first = MAX_INSTALLMENTS; break;
+        case STAGE_PLAN_PAGE: first = state.planMonth; second = state.installments; break;
+        default: break;
+        }
+        char text[160];
+        int size = snprintf(text, sizeof(text), DIALOG_STAGES[state.stage].prompt, first, second);
+        out.prompt(state.stage, string_view(text, size), turn.again);
+    }
+
+    //======================================================
+    // CLASS: PlainDialog
+    // Purpose: Renders the dialog as the plain-text reply of a
+    //          headless turn. A rejected answer gets only the
+    //          error; plans come whole.
+    //======================================================
+    class PlainDialog {
+    private:
+        const LoanApplicationSystem& system;
+        TurnText& reply;
+
+    public:
+        PlainDialog(const LoanApplicationSystem& owner, TurnText& text) : system(owner), reply(text) {}
+
+        void greeting(string_view text) { reply << text; }
+        void response(string_view text) { reply << text; }
+        void goodbye() { reply << "BYE BYE! :) Thank you for using " << system.chatbotName << "!"; }
+        void catalogChanged() { reply << "The loan catalog was updated. Please choose a loan type again."; }
+        void unavailable(string_view message) { reply << "\n" << message; }
+        void inputError(string_view text) { reply << text; }
+
+        void categoryList(string_view loanType, const CategoryIndex& categories) {
+            reply << "\n\nAvailable " << loanType << " Categories:";
+            for (int i = 0; i < categories.categoryCount(); i++) {
+                reply << "\n  " << (i + 1) << ". " << categories.name(i);
+            }
+        }
+
+        void optionList(const LoanOption* options, const CategoryIndex& categories, int category, string_view loanType) {
+            int optionCount = categories.optionCount(category);
+            reply << loanType << " Loan Options - " << categories.name(category) << "\n";
+            for (int k = 0; k < optionCount; k++) {
+                const LoanOption& option = options[categories.optionRow(category, k)];
+                reply << "\nOption " << (k + 1) << ":\n";
+                reply << "  Category: " << option.category << "\n";
+                reply << "  Details: " << option.details << "\n";
+                reply << "  Price: Rs. " << system.formatNumber(option.priceValue) << "\n";
+                reply << "  Down Payment: Rs. " << system.formatNumber(option.downPaymentValue) << "\n";
+                reply << "  Available Installment Plans: " << option.installments << " months (or custom)\n";
+            }
+        }
+
+        void termChoices(const QuoteTable& quotes, const LoanOption& loan, int row) {
+            int suggested = loan.installmentCount;
+            NumberText scratch;
+            reply << "Suggested installment plans for this loan:\n";
+            reply << "  Suggested: " << suggested << " months => Monthly Payment: Rs. " <<
+                system.quoteText(quotes, loan, row, suggested, scratch) << "\n";
+            reply << "\nCommon alternatives:\n";
+            for (int i = 0; i < 5; i++) {
+                if (STANDARD_TERMS[i] == suggested) continue;
+                reply << "  " << STANDARD_TERMS[i] << " months => Monthly Payment: Rs. " <<
+                    system.quoteText(quotes, loan, row, STANDARD_TERMS[i], scratch) << "\n";
+            }
+        }
+
+        void monthlyQuote(const QuoteTable& quotes, const LoanOption& loan, int row, int months) {
+            NumberText scratch;
+            reply << "For " << months << " months, your monthly payment will be: Rs. " <<
+                system.quoteText(quotes, loan, row, months, scratch) << "\n";
+        }
+
+        int planPageRows() const { return 0; }
+
+        void planHeader(const LoanOption& loan, string_view loanType, const ScheduleCursor& cursor) {
+            reply << "INSTALLMENT PLAN\n";
+            reply << "  Loan Type: " << loanType << "\n";
+            reply << "  Category: " << loan.category << "\n";
+            reply << "  Details: " << loan.details << "\n";
+            reply << "  Total Price: Rs. " << system.formatNumber(loan.priceValue) << "\n";
+            reply << "  Down Payment: Rs. " << system.formatNumber(loan.downPaymentValue) << "\n";
+            reply << "  Loan Amount: Rs. " << system.formatNumber(loan.priceValue - loan.downPaymentValue) << "\n";
+            if (system.annualRate > 0) {
+                reply << "  Annual Rate: " << system.formatNumber(system.annualRate) << "%\n";
+            }
+            reply << "  Number of Installments: " << cursor.term() << " months\n";
+            reply << "  Monthly Installment: Rs. " << system.formatNumber(cursor.monthly()) << "\n";
+            reply << "Month | Monthly Payment | Remaining Balance\n";
+        }
+
+        void planRow(const AmortizationRow& row) {
+            reply << row.month << " | Rs. " << system.formatNumber(row.payment) << " | Rs. " << system.formatNumber(row.balance) << "\n";
+        }
+
+        void planTotal(Money totalPaid) {
+            reply << "Total Amount Paid: Rs. " << system.formatNumber(totalPaid) << "\n";
+        }
+
+        void filterError(string_view text) {
+            if (!reply.empty()) reply << "\n\n";
+            reply << text;
+        }
+
+        void filterResult(string_view text) {
+            if (!reply.empty()) reply << "\n\n";
+            reply << text;
+        }
+
+        //======================================================
+        // FUNCTION: prompt
+        // Aim: Ends the reply with the question of the stage the
+        //      dialog is in, on a line of its own
+        //======================================================
+        void prompt(DialogStage, string_view text, bool again) {
+            if (again || text.empty()) return;
+            if (!reply.empty()) reply << "\n";
+            reply << text;
+        }
+    };
+
+    //======================================================
+    // CLASS: ScreenDialog
+    // Purpose: Renders the dialog on the console: colored
+    //          screens, and every prompt again after a rejected
+    //          answer. Long plans are paged on a terminal.
+    //======================================================
+    class ScreenDialog {
+    private:
+        const LoanApplicationSystem& system;
+        Screen& screen;
+
+        void banner(const char* title) {
+            screen.color(LIGHT_CYAN);
+            screen << "\n  ========================================================\n";
+            screen.color(LIGHT_YELLOW);
+            screen << title << "\n";
+            screen.color(LIGHT_CYAN);
+            screen << "  ========================================================\n";
+            screen.color(WHITE);
+        }
+
+    public:
+        ScreenDialog(const LoanApplicationSystem& owner, Screen& target) : system(owner), screen(target) {}
+
+        //======================================================
+        // FUNCTION: greeting
+        // Aim: Displays an attractive welcome screen with chatbot
+        //      name, then the greeting
+        //======================================================
+        void greeting(string_view text) {
+            screen.clearScreen();
+            screen.color(LIGHT_CYAN);
+            screen << "\n";
+            screen << "  ========================================================\n";
+            screen << "  ||                                                    ||\n";
+            screen.color(LIGHT_YELLOW);
+            screen << "  ||              WELCOME TO LOAN-BUDDY                 ||\n";
+            screen.color(LIGHT_CYAN);
+            screen << "  ||                                                    ||\n";
+            screen.color(MAGENTA);
+            screen << "  ||           Your Smart Loan Assistant                ||\n";
+            screen.color(LIGHT_CYAN);
+            screen << "  ||                                                    ||\n";
+            screen << "  ========================================================\n";
+            screen.color(WHITE);
+            screen << "\n";
+
+            screen.color(LIGHT_CYAN);
+            screen << system.chatbotName << ": ";
+            screen.color(MAGENTA);
+            screen << text << "\n";
+            screen.color(WHITE);
+        }
+
+        //======================================================
+        // FUNCTION: goodbye
+        // Aim: Displays a farewell message when user exits
+        //======================================================
+        void goodbye() {
+            screen.clearScreen();
+            screen.color(LIGHT_MAGENTA);
+            screen << "\n\n";
+            screen << "  ========================================================\n";
+            screen << "  ||                                                    ||\n";
+            screen.color(LIGHT_YELLOW);
+            screen << "  ||                  BYE BYE! :)                       ||\n";
+            screen.color(LIGHT_MAGENTA);
+            screen << "  ||                                                    ||\n";
+            screen.color(LIGHT_GREEN);
+            screen << "  ||          Thank you for using LOAN-BUDDY!           ||\n";
+            screen.color(LIGHT_MAGENTA);
+            screen << "  ||                                                    ||\n";
+            screen << "  ========================================================\n";
+            screen.color(WHITE);
+            screen << "\n\n";
+            screen.flush();
+            if (screen.isTerminal()) {
+                pause(2000); // Pause for 2 seconds
+            }
+        }
+
+        void response(string_view text) {
+            screen.color(LIGHT_CYAN);
+            screen << "\n" << system.chatbotName << ": ";
+            screen.color(LIGHT_GREEN);
+            screen << text << "\n";
+            screen.color(WHITE);
+        }
+
+        void catalogChanged() {
+            screen.color(LIGHT_RED);
+            screen << "\n  The loan catalog was updated. Please choose a loan type again.\n";
+            screen.color(WHITE);
+        }
+
+        void unavailable(string_view message) {
+            screen.color(LIGHT_YELLOW);
+            screen << message << "\n";
+            screen.color(WHITE);
+        }
+
+        void inputError(string_view text) {
+            screen.color(LIGHT_RED);
+            screen << "  " << text << "\n";
+        }
+
+        void categoryList(string_view loanType, const CategoryIndex& categories) {
+            screen.color(LIGHT_CYAN);
+            screen << "\n  Available " << loanType << " Categories:\n";
+            screen.color(WHITE);
+            for (int i = 0; i < categories.categoryCount(); i++) {
+                screen.color(LIGHT_GREEN);
+                screen << "    " << (i + 1) << ". " << categories.name(i) << "\n";
+            }
+            screen.color(WHITE);
+        }
+
+        //======================================================
+        // FUNCTION: optionList
+        // Aim: Displays all loan options for specific type and category
+        //======================================================
+        void optionList(const LoanOption* options, const CategoryIndex& categories, int category, string_view loanType) {
+            screen.color(LIGHT_CYAN);
+            screen << "\n  ========================================================\n";
+            screen.color(LIGHT_YELLOW);
+            screen << "          " << loanType << " Loan Options - " << categories.name(category) << "\n";
+            screen.color(LIGHT_CYAN);
+            screen << "  ========================================================\n";
+            screen.color(WHITE);
+
+            int optionCount = categories.optionCount(category);
+            for (int k = 0; k < optionCount; k++) {
+                const LoanOption& option = options[categories.optionRow(category, k)];
+
+                screen.color(LIGHT_YELLOW);
+                screen << "\n  Option " << (k + 1) << ":\n";
+                screen.color(LIGHT_GREEN);
+                screen << "    Category: ";
+                screen.color(BRIGHT_WHITE);
+                screen << option.category << "\n";
+                screen.color(LIGHT_GREEN);
+                screen << "    Details: ";
+                screen.color(BRIGHT_WHITE);
+                screen << option.details << "\n";
+                screen.color(LIGHT_GREEN);
+                screen << "    Price: ";
+                screen.color(LIGHT_CYAN);
+                screen << "Rs. " << system.formatNumber(option.priceValue) << "\n";
+                screen.color(LIGHT_GREEN);
+                screen << "    Down Payment: ";
+                screen.color(LIGHT_CYAN);
+                screen << "Rs. " << system.formatNumber(option.downPaymentValue) << "\n";
+                screen.color(LIGHT_GREEN);
+                screen << "    Available Installment Plans: ";
+                screen.color(BRIGHT_WHITE);
+                screen << option.installments << " months (or custom)\n";
+                screen.color(LIGHT_BLUE);
+                screen << "  --------------------------------------------------------\n";
+                screen.color(WHITE);
+            }
+        }
+
+        //======================================================
+        // FUNCTION: termChoices
+        // Aim: Suggested and common terms of the chosen option
+        //======================================================
+        void termChoices(const QuoteTable& quotes, const LoanOption& loan, int row) {
+            NumberText scratch;
+            banner("              SELECT NUMBER OF INSTALLMENTS");
+
+            screen.color(LIGHT_GREEN);
+            screen << "\n  Suggested installment plans for this loan:\n";
+            screen.color(WHITE);
+
+            int suggestedInstallments = loan.installmentCount;
+            screen.color(LIGHT_YELLOW);
+            screen << "    Suggested: " << suggestedInstallments << " months ";
+            screen.color(WHITE);
+            screen << "=> Monthly Payment: ";
+            screen.color(LIGHT_CYAN);
+            screen << "Rs. " << system.quoteText(quotes, loan, row, suggestedInstallments, scratch) << "\n";
+            screen.color(WHITE);
+
+            // Show some common alternatives
+            screen.color(LIGHT_GREEN);
+            screen << "\n  Common alternatives:\n";
+            screen.color(WHITE);
+
+            for (int i = 0; i < 5; i++) {
+                if (STANDARD_TERMS[i] != suggestedInstallments) {
+                    screen.color(LIGHT_YELLOW);
+                    screen << "    " << STANDARD_TERMS[i] << " months ";
+                    screen.color(WHITE);
+                    screen << "=> Monthly Payment: ";
+                    screen.color(LIGHT_CYAN);
+                    screen << "Rs. " << system.quoteText(quotes, loan, row, STANDARD_TERMS[i], scratch) << "\n";
+                    screen.color(WHITE);
+                }
+            }
+        }
+
+        void monthlyQuote(const QuoteTable& quotes, const LoanOption& loan, int row, int months) {
+            NumberText scratch;
+            banner("               YOUR MONTHLY INSTALLMENT");
+            screen.color(LIGHT_GREEN);
+            screen << "\n  For " << months << " months, your monthly payment will be: ";
+            screen.color(LIGHT_YELLOW);
+            screen << "Rs. " << system.quoteText(quotes, loan, row, months, scratch) << "\n";
+            screen.color(WHITE);
+        }
+
+        int planPageRows() const {
+            return screen.isTerminal() ? PLAN_CHUNK_ROWS : 0;
+        }
+
+        void planHeader(const LoanOption& loan, string_view loanType, const ScheduleCursor& cursor) {
+            Money loanAmount = loan.priceValue - loan.downPaymentValue;
+            banner("                  INSTALLMENT PLAN");
+
+            screen.color(LIGHT_GREEN);
+            screen << "\n  Loan Summary:\n";
+            screen.color(WHITE);
+            screen << "    Loan Type: " << loanType << "\n";
+            screen << "    Category: " << loan.category << "\n";
+            screen << "    Details: " << loan.details << "\n";
+            screen << "    Total Price: Rs. " << system.formatNumber(loan.priceValue) << "\n";
+            screen << "    Down Payment: Rs. " << system.formatNumber(loan.downPaymentValue) << "\n";
+            screen << "    Loan Amount: Rs. " << system.formatNumber(loanAmount) << "\n";
+            if (system.annualRate > 0) {
+                screen << "    Annual Rate: " << system.formatNumber(system.annualRate) << "%\n";
+            }
+            screen << "    Number of Installments: " << cursor.term() << " months\n";
+            screen.color(LIGHT_CYAN);
+            screen << "    Monthly Installment: Rs. " << system.formatNumber(cursor.monthly()) << "\n";
+            screen.color(WHITE);
+
+            screen.color(LIGHT_BLUE);
+            screen << "\n  --------------------------------------------------------\n";
+            screen.color(LIGHT_YELLOW);
+            screen << "  Month      Monthly Payment      Remaining Balance\n";
+            screen.color(LIGHT_BLUE);
+            screen << "  --------------------------------------------------------\n";
+            screen.color(WHITE);
+        }
+
+        void planRow(const AmortizationRow& row) {
+            screen << "  ";
+            char month[16];
+            screen.padLeft(string_view(month, snprintf(month, sizeof(month), "%d", row.month)), 5) << "      ";
+            screen.color(LIGHT_GREEN);
+            screen << "Rs. ";
+            screen.padRight(system.formatNumber(row.payment), 15);
+            screen.color(WHITE);
+            screen << "  ";
+            screen.color(LIGHT_CYAN);
+            screen << "Rs. " << system.formatNumber(row.balance) << "\n";
+            screen.color(WHITE);
+        }
+
+        void planTotal(Money totalPaid) {
+            screen.color(LIGHT_BLUE);
+            screen << "  --------------------------------------------------------\n";
+            screen.color(LIGHT_GREEN);
+            screen << "\n  Total Amount Paid: Rs. " << system.formatNumber(totalPaid) << "\n";
+            screen.color(WHITE);
+        }
+
+        void filterError(string_view text) {
+            screen.color(LIGHT_RED);
+            screen << "  " << text << "\n";
+            screen.color(WHITE);
+        }
+
+        void filterResult(string_view text) {
+            banner("              LOAN OPTIONS WITHIN YOUR BUDGET");
+            screen << "\n" << text;
+        }
+
+        //======================================================
+        // FUNCTION: prompt
+        // Aim: Asks for the input of the stage the dialog is in
+        //======================================================
+        void prompt(DialogStage stage, string_view text, bool again) {
+            (void)again;        // the console always asks again
+            switch (stage) {
+            case STAGE_ENDED:
+                return;
+            case STAGE_CHAT:
+                screen.color(LIGHT_YELLOW);
+                screen << "\nYou: ";
+                break;
+            case STAGE_FILTER:
+                screen.color(LIGHT_YELLOW);
+                screen << "\n  " << text;
+                break;
+            case STAGE_PLAN_PAGE:
+                screen.color(LIGHT_MAGENTA);
+                screen << "  " << text;
+                screen.color(WHITE);
+                return;
+            case STAGE_CONTINUE:
+                screen.color(LIGHT_MAGENTA);
+                screen << "\n" << text;
+                break;
+            default:
+                screen.color(LIGHT_MAGENTA);
+                screen << "\n  " << text;
+                break;
+            }
+            screen.color(BRIGHT_WHITE);
+        }
+    };
+
+public:
+    //======================================================
+    // CONSTRUCTOR: LoanApplicationSystem
+    // Aim: Initializes data members and allocates memory
+    //======================================================
+    LoanApplicationSystem() : catalog(new Catalog()) {
+    watcherStop = false;
+    chatbotName = "LOAN-BUDDY";
+    annualRate = 0;
+    grouping = GROUP_WESTERN;
+}
+
+    //======================================================
+    // DESTRUCTOR: ~LoanApplicationSystem
+    // Aim: Frees dynamically allocated memory
+    //======================================================
+    ~LoanApplicationSystem() {
+    stopWatching();
+}
+
+    //======================================================
+    // FUNCTION: setAnnualRate
+    // Aim: Sets the yearly interest rate (percent) used for
+    //      every quote and schedule
+    //======================================================
+    void setAnnualRate(double percent) {
+        annualRate = percent > 0 ? percent : 0;
+    }
+
+    //======================================================
+    // FUNCTION: setDigitGrouping
+    // Aim: Sets how amounts are grouped (Western or lakh/crore)
+    //======================================================
+    void setDigitGrouping(DigitGrouping digitGrouping) {
+        grouping = digitGrouping;
+    }
+
+    //======================================================
+    // FUNCTION: loadCatalog
+    // Aim: Loads the catalog files before the bot starts.
+    //      Returns false if the utterances file exists but
+    //      cannot be read.
+    //======================================================
+    bool loadCatalog(const CatalogFiles& catalogFiles) {
+        files = catalogFiles;
+        Catalog* data = catalog.unpublished();
+        if (!data->load(files)) return false;
+        data->buildQuotes(annualRate, grouping);
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: addUtterance
+    // Aim: Adds one input-response pair before the bot starts
+    //      (used when not loading from a file)
+    //======================================================
+    void addUtterance(const string& input, const string& response) {
+        catalog.unpublished()->addUtterance(input, response);
+    }
+
+    //======================================================
+    // FUNCTION: buildMatcher
+    // Aim: Indexes utterances added with addUtterance for
+    //      fuzzy matching
+    //======================================================
+    void buildMatcher() {
+        catalog.unpublished()->buildMatcher();
+    }
+
+    //======================================================
+    // FUNCTION: publishCatalog
+    // Aim: Swaps in a fully built catalog. Conversations in
+    //      flight finish on the old one, which is freed when
+    //      the last of them lets go.
+    //======================================================
+    void publishCatalog(Catalog* next) {
+        catalog.publish(next);
+    }
+
+    //======================================================
+    // FUNCTION: reloadCatalog
+    // Aim: Builds a new catalog from the files and publishes
+    //      it. Keeps the current one if utterances fail to load.
+    //======================================================
+    bool reloadCatalog() {
+        Catalog* next = new Catalog();
+        if (!next->load(files)) {
+            delete next;
+            METRIC_COUNT(METRIC_RELOAD_FAILURES);
+            return false;
+        }
+        next->buildQuotes(annualRate, grouping);
+        publishCatalog(next);
+        METRIC_COUNT(METRIC_RELOADS);
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: watchedPaths
+    // Aim: Every file the current catalog was built from,
+    //      including the loan files its products name
+    //======================================================
+    vector<string> watchedPaths() const {
+        vector<string> paths = { files.utterances, files.products, files.image, files.synonyms };
+        CatalogReader data(catalog);
+        for (int p = 0; p < data->productCount; p++) {
+            paths.push_back(string(data->products[p].product.file));
+        }
+        return paths;
+    }
+
+    //======================================================
+    // FUNCTION: watchCatalog
+    // Aim: Starts a background thread that polls the catalog
+    //      files every intervalMs and reloads when one of them
+    //      changes
+    //======================================================
+    void watchCatalog(int intervalMs) {
+        watcher = thread([this, intervalMs]() {
+            vector<string> paths = watchedPaths();
+            vector<filesystem::file_time_type> stamps;
+            for (const string& path : paths) {
+                stamps.push_back(fileStamp(path));
+            }
+
+            unique_lock<mutex> lock(watcherLock);
+            while (!watcherWake.wait_for(lock, chrono::milliseconds(intervalMs), [this]() { return watcherStop; })) {
+                bool changed = false;
+                for (size_t i = 0; i < paths.size(); i++) {
+                    filesystem::file_time_type stamp = fileStamp(paths[i]);
+                    if (stamp != stamps[i]) {
+                        stamps[i] = stamp;
+                        changed = true;
+                    }
+                }
+                if (!changed) continue;
+                if (!reloadCatalog()) {
+                    cerr << "Error: reload failed, keeping the current catalog" << endl;
+                }
+
+                // The products file may name other loan files now
+                paths = watchedPaths();
+                stamps.clear();
+                for (const string& path : paths) {
+                    stamps.push_back(fileStamp(path));
+                }
+            }
+        });
+    }
+
+    //======================================================
+    // FUNCTION: compileCatalog
+    // Aim: Writes the current catalog as a binary image
+    //======================================================
+    bool compileCatalog(const string& filename) const {
+        CatalogReader data(catalog);
+        return data->saveImage(filename, files);
+    }
+
+    //======================================================
+    // FUNCTION: stopWatching
+    // Aim: Stops the watcher thread, if running
+    //======================================================
+    void stopWatching() {
+        if (!watcher.joinable()) return;
+        {
+            lock_guard<mutex> lock(watcherLock);
+            watcherStop = true;
+        }
+        watcherWake.notify_all();
+        watcher.join();
+    }
+
+    //======================================================
+    // FUNCTION: exportPlan
+    // Aim: Streams the installment plan of one option to target
+    //      as CSV or JSON. The product is given by chat key or
+    //      name, the category and option by their menu numbers.
+    //      False if there is no such option.
+    //======================================================
+    bool exportPlan(string_view productName, int category, int option, int months, PlanFormat format, FILE* target) const {
+        if (months < 1 || months > MAX_INSTALLMENTS) return false;
+
+        CatalogReader data(catalog);
+        string lowerName = toLower(productName);
+        int product = data->findProduct(lowerName);
+        for (int p = 0; p < data->productCount && product < 0; p++) {
+            if (sameText(data->products[p].product.name, lowerName)) product = p;
+        }
+        const LoanOption* options = nullptr;
+        const CategoryIndex* categories = nullptr;
+        const QuoteTable* quotes = nullptr;
+        int count = 0;
+        string_view loanType;
+        productTable(*data, product, options, categories, quotes, count, loanType);
+        if (count == 0 || category < 1 || category > categories->categoryCount()) return false;
+        if (option < 1 || option > categories->optionCount(category - 1)) return false;
+        const LoanOption& loan = options[categories->optionRow(category - 1, option - 1)];
+
+        METRIC_COUNT(METRIC_PLANS);
+        METRIC_TIME(TIMED_PLAN);
+        ScheduleCursor cursor(loan.priceValue - loan.downPaymentValue, annualRate, months);
+        PlanWriter writer(target, format);
+        writer.begin(loan, loanType, annualRate, cursor);
+        AmortizationRow row;
+        while (cursor.next(row)) {
+            writer.row(row);
+        }
+        writer.end(loan.downPaymentValue + cursor.totalPaid());
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: exportPlanBatch
+    // Aim: Writes the schedule of every option of every product
+    //      for every term from firstTerm to lastTerm, in menu
+    //      order. Each round, BATCH_TASKS_PER_THREAD tasks per
+    //      thread fill one block each with a run of options
+    //      worth about BATCH_TASK_ROWS rows; the blocks are then
+    //      written in order. Memory grows with the thread count,
+    //      not with the catalog. Returns the rows written.
+    //======================================================
+    uint64_t exportPlanBatch(BatchWriter& writer, int firstTerm, int lastTerm, int threads, int& optionCount) const {
+        struct BatchPick {
+            int product;
+            int category;
+            int option;
+        };
+
+        CatalogReader data(catalog);
+        int terms = lastTerm - firstTerm + 1;
+        int rowsPerOption = (firstTerm + lastTerm) * terms / 2;
+        int optionsPerTask = max(1, BATCH_TASK_ROWS / rowsPerOption);
+        int taskCount = max(threads, 1) * BATCH_TASKS_PER_THREAD;
+        vector<BatchBlock> blocks(taskCount);
+        vector<string> prefixes(taskCount);
+        vector<BatchPick> picks;
+        int product = 0;
+        int category = 0;
+        int option = 0;
+        uint64_t rows = 0;
+        optionCount = 0;
+        while (true) {
+            picks.clear();
+            while ((int)picks.size() < taskCount * optionsPerTask && product < data->productCount) {
+                const CategoryIndex& categories = data->products[product].categories;
+                if (category >= categories.categoryCount()) {
+                    product++;
+                    category = 0;
+                }
+                else if (option >= categories.optionCount(category)) {
+                    category++;
+                    option = 0;
+                }
+                else {
+                    picks.push_back({ product, category, option++ });
+                }
+            }
+            if (picks.empty()) break;
+
+            int tasks = ((int)picks.size() + optionsPerTask - 1) / optionsPerTask;
+            runTasks(tasks, threads, [&](int t) {
+                BatchBlock& block = blocks[t];
+                string& prefix = prefixes[t];
+                block.clear();
+                int last = min((t + 1) * optionsPerTask, (int)picks.size());
+                for (int i = t * optionsPerTask; i < last; i++) {
+                    const BatchPick& pick = picks[i];
+                    const ProductTable& table = data->products[pick.product];
+                    const LoanOption& loan = data->optionsOf(pick.product)[table.categories.optionRow(pick.category, pick.option)];
+                    prefix.clear();
+                    appendCsvField(prefix, table.product.name);
+                    prefix += ',';
+                    appendCsvField(prefix, table.categories.name(pick.category));
+                    prefix += ',';
+                    prefix += to_string(pick.option + 1);
+                    prefix += ',';
+                    fillBatchBlock(loan, prefix, firstTerm, lastTerm, annualRate, writer.outputFormat(),
+                        (int32_t)((optionCount + i) * terms), block);
+                }
+            });
+            for (int t = 0; t < tasks; t++) {
+                writer.write(blocks[t]);
+                rows += blocks[t].rows;
+            }
+            optionCount += (int)picks.size();
+        }
+        return rows;
+    }
+
+    //======================================================
+    // FUNCTION: getResponse
+    // Aim: Returns chatbot response for user input by
+    //      looking it up in the utterance hash index.
+    //======================================================
+    string getResponse(const string& input) const {
+        CatalogReader data(catalog);
+        TurnArena arena;
+        return string(lookupResponse(*data, data->normalizer.apply(trim(input), arena)));
+    }
+
+    //======================================================
+    // FUNCTION: scanResponse
+    // Aim: Reference linear scan over all utterances. Kept to
+    //      benchmark and cross-check the hash index.
+    //======================================================
+    string scanResponse(const string& input) {
+        CatalogReader data(catalog);
+        TurnArena arena;
+        string_view normalInput = data->normalizer.apply(trim(input), arena);
+
+        for (int i = 0; i < data->utteranceCount; i++) {
+            if (data->utterances[i].input == normalInput) {
+                return string(data->utterances[i].response);
+            }
+        }
+        return string(data->defaultResponse);
+    }
+
+    //======================================================
+    // FUNCTION: step
+    // Aim: Advances a conversation by one message and never
+    //      blocks: the handler of the current stage answers
+    //      into out, then the prompt of the next stage follows.
+    //      Out renders the dialog (PlainDialog, ScreenDialog).
+    //      Only reads the current catalog snapshot, so any
+    //      number of threads may call it at once.
+    //======================================================
+    template <class Out>
+    void step(SessionState& state, string_view message, TurnArena& arena, Out& out) const {
+        METRIC_COUNT(METRIC_TURNS);
+        CatalogReader data(catalog);
+        string_view input = trim(message);
+        DialogTurn turn{ *data, arena, input, arena.lower(input), data->normalizer.apply(input, arena) };
+        const DialogStageInfo& stage = DIALOG_STAGES[state.stage];
+
+        if (stage.xExits && turn.lowerInput == "x") {
+            state = SessionState();
+            state.stage = STAGE_ENDED;
+            out.goodbye();
+            return;
+        }
+
+        productTable(*data, state.product, turn.options, turn.categories, turn.quotes, turn.count, turn.loanType);
+        if (stateFits(state, turn, stage.needs)) {
+            switch (state.stage) {
+            case STAGE_CHAT: onChat(state, turn, out); break;
+            case STAGE_CATEGORY: onCategory(state, turn, out); break;
+            case STAGE_OPTION: onOption(state, turn, out); break;
+            case STAGE_TERM: onTerm(state, turn, out); break;
+            case STAGE_PLAN_CONFIRM: onPlanConfirm(state, turn, out); break;
+            case STAGE_PLAN_PAGE: onPlanPage(state, turn, out); break;
+            case STAGE_FILTER: onFilter(state, turn, out); break;
+            case STAGE_CONTINUE: onContinue(state, turn, out); break;
+            case STAGE_ENDED: onEnded(state, turn, out); break;
+            }
+        }
+        else {
+            state = SessionState();
+            out.catalogChanged();
+        }
+        prompt(state, turn, out);
+    }
+
+    //======================================================
+    // FUNCTION: handleMessage
+    // Aim: Headless turn: one step rendered as plain text,
+    //      built in arena (valid until its next reset)
+    //======================================================
+    string_view handleMessage(SessionState& state, string_view message, TurnArena& arena) const {
+        TurnText reply(arena);
+        PlainDialog dialog(*this, reply);
+        step(state, message, arena, dialog);
+        return reply.view();
+    }
+
+    //======================================================
+    // FUNCTION: handleMessage
+    // Aim: Convenience form that returns the reply as a string,
+    //      using a scratch arena of the calling thread
+    //======================================================
+    string handleMessage(SessionState& state, const string& message) const {
+        thread_local TurnArena arena;
+        arena.reset();
+        return string(handleMessage(state, message, arena));
+    }
+
+    //======================================================
+    // FUNCTION: renderBenchmarkScreens
+    // Aim: Renders the option screen of every category of the
+    //      first product and a 120-month plan for its first
+    //      option, one flush per screen. Used by --bench-render;
+    //      returns screen count.
+    //======================================================
+    int renderBenchmarkScreens() {
+        CatalogReader data(catalog);
+        if (data->productCount == 0) return 0;
+        const ProductTable& table = data->products[0];
+        const LoanOption* options = data->optionsOf(0);
+        ScreenDialog dialog(*this, screen);
+        SessionState state;
+        state.installments = 120;
+        int screens = 0;
+        for (int c = 0; c < table.categories.categoryCount(); c++) {
+            dialog.optionList(options, table.categories, c, table.product.name);
+            screen.flush();
+            showPlan(options[table.categories.optionRow(c, 0)], table.product.name, state, 0, true, dialog);
+            screen.flush();
+            screens += 2;
+        }
+        return screens;
+    }
+
+    Screen& getScreen() { return screen; }
+
+#ifdef LOANBUDDY_METRICS
+    //======================================================
+    // FUNCTION: metricsText
+    // Aim: Metrics of all threads as Prometheus text or JSON.
+    //      Category picks are labeled with the category names
+    //      of the current catalog.
+    //======================================================
+    string metricsText(bool json) const {
+        MetricTotals totals = MetricsRegistry::instance().totals();
+        CatalogReader data(catalog);
+        string out;
+        char number[64];
+
+        auto quoted = [&out](string_view text) {
+            out += '"';
+            for (char c : text) {
+                if (c == '"' || c == '\\') out += '\\';
+                if (c == '\n') out += "\\n";
+                else out += c;
+            }
+            out += '"';
+        };
+        auto bucketBound = [&number](int bucket) {
+            return string_view(number, snprintf(number, sizeof(number), "%.9g", ldexp(1.0, bucket) / 1e9));
+        };
+
+        out += json ? "{\"counters\":{" : "";
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+            string value = to_string(totals.counters[i]);
+            if (json) {
+                out += i > 0 ? "," : "";
+                quoted(METRIC_COUNTER_NAMES[i]);
+                out += ":" + value;
+            }
+            else {
+                out += string("# TYPE loanbuddy_") + METRIC_COUNTER_NAMES[i] + " counter\n";
+                out += string("loanbuddy_") + METRIC_COUNTER_NAMES[i] + " " + value + "\n";
+            }
+        }
+
+        out += json ? "},\"categorySelections\":[" : "# TYPE loanbuddy_category_selections_total counter\n";
+        bool first = true;
+        for (int p = 0; p < min(data->productCount, METRIC_PRODUCTS); p++) {
+            const LoanOption* options = nullptr;
+            const CategoryIndex* categories = nullptr;
+            const QuoteTable* quotes = nullptr;
+            int count = 0;
+            string_view loanType;
+            productTable(*data, p, options, categories, quotes, count, loanType);
+            for (int c = 0; c <= METRIC_CATEGORIES; c++) {
+                if (totals.categoryPicks[p][c] == 0) continue;
+                string_view category = c < METRIC_CATEGORIES && c < categories->categoryCount() ? categories->name(c) : "other";
+                if (json) {
+                    out += first ? "{\"product\":" : ",{\"product\":";
+                    quoted(loanType);
+                    out += ",\"category\":";
+                    quoted(category);
+                    out += ",\"count\":" + to_string(totals.categoryPicks[p][c]) + "}";
+                }
+                else {
+                    out += "loanbuddy_category_selections_total{product=";
+                    quoted(loanType);
+                    out += ",category=";
+                    quoted(category);
+                    out += "} " + to_string(totals.categoryPicks[p][c]) + "\n";
+                }
+                first = false;
+            }
+        }
+
+        out += json ? "],\"stages\":{" : "# TYPE loanbuddy_stage_duration_seconds histogram\n";
+        for (int s = 0; s < TIMED_STAGE_COUNT; s++) {
+            uint64_t calls = 0;
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) calls += totals.buckets[s][b];
+            string seconds(number, snprintf(number, sizeof(number), "%.9f", totals.totalNanoseconds[s] / 1e9));
+            string stage = TIMED_STAGE_NAMES[s];
+
+            if (json) {
+                out += s > 0 ? "," : "";
+                quoted(stage);
+                out += ":{\"count\":" + to_string(calls) + ",\"sumSeconds\":" + seconds + ",\"buckets\":{";
+                bool firstBucket = true;
+                for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                    if (totals.buckets[s][b] == 0) continue;
+                    out += firstBucket ? "" : ",";
+                    quoted(b < HISTOGRAM_BUCKETS - 1 ? bucketBound(b) : "+Inf");
+                    out += ":" + to_string(totals.buckets[s][b]);
+                    firstBucket = false;
+                }
+                out += "}}";
+                continue;
+            }
+
+            uint64_t cumulative = 0;
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                cumulative += totals.buckets[s][b];
+                out += "loanbuddy_stage_duration_seconds_bucket{stage=\"" + stage + "\",le=\"";
+                out += b < HISTOGRAM_BUCKETS - 1 ? bucketBound(b) : "+Inf";
+                out += "\"} " + to_string(cumulative) + "\n";
+            }
+            out += "loanbuddy_stage_duration_seconds_sum{stage=\"" + stage + "\"} " + seconds + "\n";
+            out += "loanbuddy_stage_duration_seconds_count{stage=\"" + stage + "\"} " + to_string(calls) + "\n";
+        }
+        out += json ? "}}\n" : "";
+        return out;
+    }
+
+    //======================================================
+    // FUNCTION: dumpMetrics
+    // Aim: Writes the metrics to path ("-" for stdout, a Unix
+    //      socket, or a file; JSON if it ends in .json)
+    //======================================================
+    bool dumpMetrics(const string& path) const {
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        return deliverMetrics(path, metricsText(json));
+    }
+#endif
+
+    //======================================================
+    // FUNCTION: run
+    // Aim: Runs the chatbot application loop: one dialog
+    //      step per console line until the user exits.
+    //======================================================
+    void run() {
+        ScreenDialog dialog(*this, screen);
+        SessionState state;
+        state.stage = STAGE_ENDED;      // the first step greets
+
+        consoleArena.reset();
+        step(state, "", consoleArena, dialog);
+        while (state.stage != STAGE_ENDED && readLine(inputLine)) {
+            consoleArena.reset();
+            step(state, inputLine, consoleArena, dialog);
+        }
+        screen.flush();
+    }
+
+};
+
+//======================================================
+// STRUCTURE: EngineReply
+// Purpose: Result of one headless message
+//======================================================
+struct EngineReply {
+    string sessionId;
+    string response;
+    SessionState state;
+};
+
+//======================================================
+// SESSION JOURNAL
+// Headless sessions survive a restart. Every turn appends the
+// session's new state to a journal file, and the live states
+// are written out as a snapshot once the journal has grown to
+// twice their number, after which the journal starts over.
+// Files are sessions-<worker>.snap and sessions-<worker>.log:
+//   header: "LBSJ", u32 version, u64 generation
+//   record: u16 id length, id, SessionState (encoded),
+//           u32 checksum of the record so far
+// A journal counts only if it has its snapshot's generation,
+// so a crash between writing a snapshot and truncating the
+// journal replays nothing twice. A torn last record fails its
+// checksum and ends the replay. Ended sessions are recorded
+// with STAGE_ENDED and dropped. Records are written, not
+// synced: a killed process loses nothing, a power cut may.
+//======================================================
+static const char JOURNAL_MAGIC[4] = { 'L', 'B', 'S', 'J' };
+static const uint32_t JOURNAL_VERSION = 2;
+static const int JOURNAL_HEADER_BYTES = 16;
+static const size_t SNAPSHOT_MIN_RECORDS = 4096;    // journal records before a snapshot is worth it
+
+//======================================================
+// CLASS: SessionJournal
+// Purpose: Journal and snapshot of one worker's sessions.
+//          Used only by that worker's thread.
+//======================================================
+class SessionJournal {
+private:
+    string snapshotPath;
+    string journalPath;
+    FILE* journal;
+    uint64_t generation;
+    size_t journalRecords;      // records since the last snapshot
+    string record;              // reused for every append
+
+    SessionJournal(const SessionJournal&) = delete;
+    SessionJournal& operator=(const SessionJournal&) = delete;
+
+    static void appendHeader(string& out, uint64_t fileGeneration) {
+        out.append(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        for (int b = 0; b < 4; b++) out += (char)(JOURNAL_VERSION >> (8 * b));
+        for (int b = 0; b < 8; b++) out += (char)(fileGeneration >> (8 * b));
+    }
+
+    static void appendRecord(string& out, string_view id, const SessionState& state) {
+        size_t start = out.size();
+        out += (char)(id.size() & 0xff);
+        out += (char)(id.size() >> 8);
+        out.append(id.data(), id.size());
+        unsigned char encoded[SessionState::ENCODED_BYTES];
+        state.encode(encoded);
+        out.append((const char*)encoded, sizeof(encoded));
+        uint32_t checksum = (uint32_t)imageChecksum(string_view(out).substr(start));
+        for (int b = 0; b < 4; b++) out += (char)(checksum >> (8 * b));
+    }
+
+    //======================================================
+    // FUNCTION: writeSnapshot
+    // Aim: Writes sessions to the snapshot file (through a
+    //      temporary file and a rename), then starts an empty
+    //      journal of the same generation
+    //======================================================
+    bool writeSnapshot(const unordered_map<string, SessionState>& sessions) {
+        generation++;
+        string bytes;
+        appendHeader(bytes, generation);
+        for (const auto& session : sessions) {
+            appendRecord(bytes, session.first, session.second);
+        }
+
+        string temporary = snapshotPath + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr) return false;
+        bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        written = fclose(file) == 0 && written;
+        error_code error;
+        if (written) filesystem::rename(temporary, snapshotPath, error);
+        if (!written || error) return false;
+
+        if (journal != nullptr) fclose(journal);
+        journal = fopen(journalPath.c_str(), "wb");
+        if (journal == nullptr) return false;
+        bytes.clear();
+        appendHeader(bytes, generation);
+        fwrite(bytes.data(), 1, bytes.size(), journal);
+        fflush(journal);
+        journalRecords = 0;
+        return true;
+    }
+
+    //======================================================
+    // FUNCTION: readFile
+    // Aim: Applies the records of one snapshot or journal to
+    //      sessions. Returns the file's generation, or 0 if it
+    //      is missing, foreign, or not of the wanted generation
+    //      (any generation when wanted is 0).
+    //======================================================
+    static uint64_t readFile(const string& path, uint64_t wanted, unordered_map<string, SessionState>& sessions) {
+        ifstream file(path, ios::binary);
+        string bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        if (bytes.size() < (size_t)JOURNAL_HEADER_BYTES || memcmp(bytes.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+            return 0;
+        }
+        const unsigned char* data = (const unsigned char*)bytes.data();
+        uint32_t version = 0;
+        uint64_t fileGeneration = 0;
+        for (int b = 0; b < 4; b++) version |= (uint32_t)data[4 + b] << (8 * b);
+        for (int b = 0; b < 8; b++) fileGeneration |= (uint64_t)data[8 + b] << (8 * b);
+        if (version != JOURNAL_VERSION || (wanted != 0 && fileGeneration != wanted)) return 0;
+
+        size_t at = JOURNAL_HEADER_BYTES;
+        while (at + 2 <= bytes.size()) {
+            size_t idLength = data[at] | (size_t)data[at + 1] << 8;
+            size_t end = at + 2 + idLength + SessionState::ENCODED_BYTES + 4;
+            if (end > bytes.size()) break;
+
+            uint32_t checksum = 0;
+            for (int b = 0; b < 4; b++) checksum |= (uint32_t)data[end - 4 + b] << (8 * b);
+            SessionState state;
+            if (checksum != (uint32_t)imageChecksum(string_view(bytes).substr(at, end - 4 - at)) ||
+                !state.decode(data + at + 2 + idLength)) {
+                break;
+            }
+
+            string id = bytes.substr(at + 2, idLength);
+            if (state.stage == STAGE_ENDED) sessions.erase(id);
+            else sessions[id] = state;
+            at = end;
+        }
+        return fileGeneration;
+    }
+
+public:
+    SessionJournal() : journal(nullptr), generation(0), journalRecords(0) {}
+
+    ~SessionJournal() {
+        if (journal != nullptr) fclose(journal);
+    }
+
+    static string filePath(const string& directory, int worker, const char* extension) {
+        return (filesystem::path(directory) / ("sessions-" + to_string(worker) + extension)).string();
+    }
+
+    //======================================================
+    // FUNCTION: restore
+    // Aim: Reads every worker's snapshot and journal found in
+    //      directory, whatever the worker count was, into
+    //      sessions. Returns the highest generation seen.
+    //======================================================
+    static uint64_t restore(const string& directory, unordered_map<string, SessionState>& sessions) {
+        vector<pair<uint64_t, int>> found;      // (generation, worker), replayed oldest first
+        error_code error;
+        for (const auto& entry : filesystem::directory_iterator(directory, error)) {
+            string name = entry.path().filename().string();
+            if (name.compare(0, 9, "sessions-") != 0 || name.size() < 15 ||
+                name.compare(name.size() - 5, 5, ".snap") != 0) {
+                continue;
+            }
+            int worker = atoi(name.c_str() + 9);
+            unordered_map<string, SessionState> probe;
+            uint64_t fileGeneration = readFile(entry.path().string(), 0, probe);
+            if (fileGeneration != 0) found.push_back(make_pair(fileGeneration, worker));
+        }
+        sort(found.begin(), found.end());
+
+        uint64_t newest = 0;
+        for (const auto& file : found) {
+            readFile(filePath(directory, file.second, ".snap"), file.first, sessions);
+            readFile(filePath(directory, file.second, ".log"), file.first, sessions);
+            newest = max(newest, file.first);
+        }
+        return newest;
+    }
+
+    //======================================================
+    // FUNCTION: open
+    // Aim: Takes over the files of one worker: writes its
+    //      restored sessions as a snapshot after generation
+    //      and starts an empty journal
+    //======================================================
+    bool open(const string& directory, int worker, uint64_t afterGeneration,
+        const unordered_map<string, SessionState>& sessions) {
+        snapshotPath = filePath(directory, worker, ".snap");
+        journalPath = filePath(directory, worker, ".log");
+        generation = afterGeneration;
+        return writeSnapshot(sessions);
+    }
+
+    bool isOpen() const { return journal != nullptr; }
+
+    //======================================================
+    // FUNCTION: append
+    // Aim: Journals the state a session reached in one turn.
+    //      Snapshots sessions (the worker's live sessions)
+    //      when the journal holds twice as many records.
+    //======================================================
+    bool append(const string& id, const SessionState& state, const unordered_map<string, SessionState>& sessions) {
+        if (journal == nullptr || id.size() > 0xffff) return false;
+        record.clear();
+        appendRecord(record, id, state);
+        bool written = fwrite(record.data(), 1, record.size(), journal) == record.size() && fflush(journal) == 0;
+        journalRecords++;
+        if (journalRecords >= max(SNAPSHOT_MIN_RECORDS, 2 * sessions.size())) {
+            written = writeSnapshot(sessions) && written;
+        }
+        return written;
+    }
+
+    //======================================================
+    // FUNCTION: removeStale
+    // Aim: Deletes the files of workers numbered workerCount
+    //      and up, once their sessions live in the others
+    //======================================================
+    static void removeStale(const string& directory, int workerCount) {
+        error_code error;
+        vector<filesystem::path> stale;
+        for (const auto& entry : filesystem::directory_iterator(directory, error)) {
+            string name = entry.path().filename().string();
+            if (name.compare(0, 9, "sessions-") == 0 && atoi(name.c_str() + 9) >= workerCount) {
+                stale.push_back(entry.path());
+            }
+        }
+        for (const filesystem::path& path : stale) filesystem::remove(path, error);
+    }
+};
+
+//======================================================
+// CLASS: ChatEngine
+// Purpose: Serves many conversations at once on a pool of
+//          worker threads. Every session is pinned to one
+//          worker (by hash of its id), so its messages are
+//          handled in order and its state needs no locking.
+//          The LoanApplicationSystem is shared read-only.
+//======================================================
+class ChatEngine {
+private:
+    struct Task {
+        string sessionId;
+        string message;
+        function<void(const EngineReply&)> done;
+    };
+
+    struct Worker {
+        mutex lock;
+        condition_variable ready;
+        deque<Task> queue;
+        bool stopping = false;
+        unordered_map<string, SessionState> sessions;   // touched only by this worker's thread
+        SessionJournal journal;                         // likewise; closed unless sessions persist
+        thread handle;
+    };
+
+    const LoanApplicationSystem& system;
+    vector<Worker*> workers;
+
+    //======================================================
+    // FUNCTION: workerLoop
+    // Aim: Pops tasks for one worker until shutdown and the
+    //      queue is empty.
+    //======================================================
+    void workerLoop(Worker* worker) {
+        while (true) {
+            Task task;
+            {
+                unique_lock<mutex> guard(worker->lock);
+                worker->ready.wait(guard, [&] { return worker->stopping || !worker->queue.empty(); });
+                if (worker->queue.empty()) return;
+                task = move(worker->queue.front());
+                worker->queue.pop_front();
+            }
+
+            EngineReply reply;
+            reply.sessionId = task.sessionId;
+            SessionState& state = worker->sessions[task.sessionId];
+            reply.response = system.handleMessage(state, task.message);
+            reply.state = state;
+            if (state.stage == STAGE_ENDED) {
+                worker->sessions.erase(task.sessionId);
+            }
+            if (worker->journal.isOpen() && !worker->journal.append(task.sessionId, reply.state, worker->sessions)) {
+                cerr << "Error: could not journal session " << task.sessionId << endl;
+            }
+            if (task.done) task.done(reply);
+        }
+    }
+
+    //======================================================
+    // FUNCTION: restoreSessions
+    // Aim: Loads the sessions journaled in directory (by any
+    //      number of workers), hands each to the worker its id
+    //      hashes to, and opens the workers' journals there
+    //======================================================
+    bool restoreSessions(const string& directory) {
+        error_code error;
+        filesystem::create_directories(directory, error);
+        unordered_map<string, SessionState> restored;
+        uint64_t generation = SessionJournal::restore(directory, restored);
+        for (auto& session : restored) {
+            Worker* worker = workers[HashIndex::hashKey(session.first) % workers.size()];
+            worker->sessions.insert(move(session));
+        }
+
+        bool opened = true;
+        for (size_t i = 0; i < workers.size(); i++) {
+            opened = workers[i]->journal.open(directory, (int)i, generation, workers[i]->sessions) && opened;
+        }
+        if (opened) SessionJournal::removeStale(directory, (int)workers.size());
+        return opened;
+    }
+
+public:
+    //======================================================
+    // CONSTRUCTOR: ChatEngine
+    // Aim: Starts threadCount workers (0 = hardware threads).
+    //      With a sessionDirectory, sessions are journaled
+    //      there and those of an earlier run are resumed.
+    //======================================================
+    ChatEngine(const LoanApplicationSystem& sharedSystem, int threadCount, const string& sessionDirectory = "")
+        : system(sharedSystem) {
+        if (threadCount <= 0) {
+            threadCount = (int)thread::hardware_concurrency();
+            if (threadCount <= 0) threadCount = 1;
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers.push_back(new Worker());
+        }
+        if (!sessionDirectory.empty() && !restoreSessions(sessionDirectory)) {
+            cerr << "Error: could not write sessions to " << sessionDirectory << ", they will not persist" << endl;
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers[i]->handle = thread(&ChatEngine::workerLoop, this, workers[i]);
+        }
+    }
+
+    //======================================================
+    // DESTRUCTOR: ~ChatEngine
+    // Aim: Finishes queued messages and joins the workers
+    //======================================================
+    ~ChatEngine() {
+        shutdown();
+        for (size_t i = 0; i < workers.size(); i++) {
+            delete workers[i];
+        }
+    }
+
+    //======================================================
+    // FUNCTION: submit
+    // Aim: Queues a message for a session; done is called on
+    //      the worker thread with the reply.
+    //======================================================
+    void submit(const string& sessionId, const string& message, function<void(const EngineReply&)> done) {
+        Worker* worker = workers[HashIndex::hashKey(sessionId) % workers.size()];
+        {
+            lock_guard<mutex> guard(worker->lock);
+            worker->queue.push_back(Task{ sessionId, message, move(done) });
+        }
+        worker->ready.notify_one();
+    }
+
+    //======================================================
+    // FUNCTION: handle
+    // Aim: Synchronous convenience wrapper around submit
+    //======================================================
+    EngineReply handle(const string& sessionId, const string& message) {
+        promise<EngineReply> result;
+        future<EngineReply> pending = result.get_future();
+        submit(sessionId, message, [&result](const EngineReply& reply) { result.set_value(reply); });
+        return pending.get();
+    }
+
+    //======================================================
+    // FUNCTION: shutdown
+    // Aim: Drains all queues and stops the workers
+    //======================================================
+    void shutdown() {
+        for (size_t i = 0; i < workers.size(); i++) {
+            lock_guard<mutex> guard(workers[i]->lock);
+            workers[i]->stopping = true;
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->ready.notify_all();
+            if (workers[i]->handle.joinable()) workers[i]->handle.join();
+        }
+    }
+};
+
+//======================================================
+// FUNCTION: escapeLine
+// Aim: Escapes backslashes and newlines so a reply fits on
+//      one protocol line
+//======================================================
+string escapeLine(const string& text) {
+    string escaped;
+    escaped.reserve(text.size() + 8);
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\\') escaped += "\\\\";
+        else if (text[i] == '\n') escaped += "\\n";
+        else if (text[i] != '\r') escaped += text[i];
+    }
+    return escaped;
+}
+
+//======================================================
+// FUNCTION: runServer
+// Aim: stdin/stdout line protocol for headless use.
+//      Request:  <session id>#<message>
+//      Reply:    <session id>#<stage>#<escaped response>
+//      Replies for different sessions may come out of order.
+//      With metrics built in, the line !metrics writes them to
+//      metricsPath and is answered with #metrics#ok.
+//      With a sessionDirectory, sessions outlive the process.
+//======================================================
+int runServer(const LoanApplicationSystem& chatbot, int threadCount, const char* metricsPath, const char* sessionDirectory) {
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);   // getline must not flush cout behind the workers' backs
+    mutex outputLock;
+    ChatEngine engine(chatbot, threadCount, sessionDirectory ? sessionDirectory : "");
+
+    string line;
+    while (getline(cin, line)) {
+        size_t pos = line.find('#');
+#ifdef LOANBUDDY_METRICS
+        if (line == "!metrics") {
+            bool dumped = metricsPath != nullptr && chatbot.dumpMetrics(metricsPath);
+            lock_guard<mutex> guard(outputLock);
+            cout << (dumped ? "#metrics#ok\n" : "#error#could not write metrics (see --metrics)\n") << flush;
+            continue;
+        }
+#else
+        (void)metricsPath;
+#endif
+        if (pos == string::npos) {
+            lock_guard<mutex> guard(outputLock);
+            cout << "#error#expected <session id>#<message>\n" << flush;
+            continue;
+        }
+        engine.submit(line.substr(0, pos), line.substr(pos + 1), [&outputLock](const EngineReply& reply) {
+            string out = reply.sessionId + "#" + stageName(reply.state.stage) + "#" + escapeLine(reply.response) + "\n";
+            lock_guard<mutex> guard(outputLock);
+            cout << out << flush;
+        });
+    }
+    engine.shutdown();
+    return 0;
+}
+
+//======================================================
+// FUNCTION: jsonString
+// Aim: Reads the string value of key from one flat JSON
+//      object line (the replay JSONL format). Handles the
+//      usual escapes; \\u escapes are kept only for ASCII.
+//======================================================
+bool jsonString(const string& line, const string& key, string& value) {
+    size_t at = line.find("\"" + key + "\"");
+    if (at == string::npos) return false;
+    at = line.find(':', at + key.size() + 2);
+    if (at == string::npos) return false;
+    at = line.find('"', at);
+    if (at == string::npos) return false;
+
+    value.clear();
+    for (size_t i = at + 1; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '"') return true;
+        if (c != '\\' || i + 1 == line.size()) {
+            value += c;
+            continue;
+        }
+        char escaped = line[++i];
+        if (escaped == 'n') value += '\n';
+        else if (escaped == 't') value += '\t';
+        else if (escaped == 'r') value += '\r';
+        else if (escaped == 'u' && i + 4 < line.size()) {
+            int code = (int)strtol(line.substr(i + 1, 4).c_str(), nullptr, 16);
+            value += code > 0 && code < 128 ? (char)code : '?';
+            i += 4;
+        }
+        else value += escaped;
+    }
+    return false;
+}
+
+//======================================================
+// STRUCTURE: ReplayTurn
+// Purpose: One recorded user message
+//======================================================
+struct ReplayTurn {
+    string sessionId;
+    string message;
+};
+
+//======================================================
+// FUNCTION: loadTranscript
+// Aim: Appends the turns of one recording. A .jsonl file is
+//      a stream of {"session": ..., "message": ...} lines,
+//      any other file is one conversation, one message per
+//      line.
+//======================================================
+bool loadTranscript(const string& filename, vector<ReplayTurn>& turns) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Error: Could not open " << filename << endl;
+        return false;
+    }
+
+    bool jsonl = filename.size() > 6 && filename.compare(filename.size() - 6, 6, ".jsonl") == 0;
+    string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        ReplayTurn turn;
+        if (!jsonl) {
+            turn.sessionId = filename;
+            turn.message = line;
+        }
+        else if (line.find_first_not_of(" \t") == string::npos) {
+            continue;
+        }
+        else if (!jsonString(line, "session", turn.sessionId) || !jsonString(line, "message", turn.message)) {
+            cerr << "Error: " << filename << ":" << lineNumber << ": expected session and message, line skipped" << endl;
+            continue;
+        }
+        turns.push_back(turn);
+    }
+    return true;
+}
+
+//======================================================
+// FUNCTION: runPlanBatch
+// Aim: --batch-plans: writes the schedule of every option for
+//      a range of terms and reports rows per second on stderr
+//      (stdout may be the CSV)
+//======================================================
+int runPlanBatch(const LoanApplicationSystem& chatbot, const char* output, const char* format, const char* terms, const char* threads) {
+    int firstTerm = 1;
+    int lastTerm = BATCH_TERMS;
+    if (terms != nullptr && sscanf(terms, "%d-%d", &firstTerm, &lastTerm) == 1) lastTerm = firstTerm;
+    bool columns = format != nullptr && strcmp(format, "columns") == 0;
+    if (output == nullptr || firstTerm < 1 || lastTerm < firstTerm || lastTerm > MAX_INSTALLMENTS ||
+        (format != nullptr && !columns && strcmp(format, "csv") != 0)) {
+        cerr << "Usage: --batch-plans <file|-|directory> [--format csv|columns] [--terms <first>-<last>]"
+            << " [--threads n] (terms 1-" << MAX_INSTALLMENTS << ")" << endl;
+        return 1;
+    }
+    int threadCount = threads != nullptr ? atoi(threads) : 0;
+    if (threadCount <= 0) threadCount = max(1, (int)thread::hardware_concurrency());
+
+    BatchWriter writer;
+    auto start = chrono::steady_clock::now();
+    int optionCount = 0;
+    uint64_t rows = 0;
+    if (writer.open(output, columns ? BATCH_COLUMNS : BATCH_CSV)) {
+        rows = chatbot.exportPlanBatch(writer, firstTerm, lastTerm, threadCount, optionCount);
+    }
+    if (!writer.close()) {
+        cerr << "Error: Could not write " << output << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "  " << optionCount << " options, terms " << firstTerm << "-" << lastTerm << ": " << rows << " rows in "
+        << fixed << setprecision(2) << seconds << " s (" << setprecision(0) << rows / max(seconds, 1e-9)
+        << " rows/s on " << threadCount << " threads)" << endl;
+    return 0;
+}
+
+//======================================================
+// FUNCTION: runReplay
+// Aim: Feeds recorded conversations through handleMessage,
+//      replies kept in memory, and reports per-turn latency
+//      percentiles, throughput, allocations per turn and a
+//      checksum of all replies (to spot behaviour changes)
+//======================================================
+int runReplay(const LoanApplicationSystem& chatbot, const vector<string>& files, int repeat) {
+    vector<ReplayTurn> turns;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!loadTranscript(files[i], turns)) return 1;
+    }
+    if (turns.empty()) {
+        cerr << "Nothing to replay" << endl;
+        return 1;
+    }
+
+    // Sessions are resolved once; the timed loop only runs turns
+    unordered_map<string, int> sessionOf;
+    vector<int> turnSession(turns.size());
+    for (size_t i = 0; i < turns.size(); i++) {
+        auto found = sessionOf.emplace(turns[i].sessionId, (int)sessionOf.size());
+        turnSession[i] = found.first->second;
+    }
+
+    vector<double> latencies;
+    latencies.reserve(turns.size() * repeat);
+    vector<SessionState> sessions(sessionOf.size());
+    uint64_t replyHash = 14695981039346656037ULL;
+    uint64_t replyBytes = 0;
+    uint64_t allocationCount = 0;
+    uint64_t allocationBytes = 0;
+    double busyUs = 0;
+    TurnArena arena;
+
+    for (int round = 0; round < repeat; round++) {
+        sessions.assign(sessions.size(), SessionState());
+        for (size_t i = 0; i < turns.size(); i++) {
+            SessionState& state = sessions[turnSession[i]];
+            AllocationCounter before = allocations;
+            auto start = chrono::steady_clock::now();
+            arena.reset();
+            string_view reply = chatbot.handleMessage(state, turns[i].message, arena);
+            double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            allocationCount += allocations.count - before.count;
+            allocationBytes += allocations.bytes - before.bytes;
+
+            latencies.push_back(us);
+            busyUs += us;
+            if (round == 0) {
+                replyBytes += reply.size();
+                replyHash = (replyHash ^ HashIndex::hashKey(reply)) * 1099511628211ULL;
+            }
+        }
+    }
+
+    size_t turnCount = latencies.size();
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) { return latencies[(size_t)(p * (latencies.size() - 1))]; };
+
+    cout << fixed << setprecision(2);
+    cout << "  Conversations:          " << sessionOf.size() << endl;
+    cout << "  Turns replayed:         " << turnCount << " (" << turns.size() << " x " << repeat << ")" << endl;
+    cout << "  Turn latency p50:       " << percentile(0.50) << " us" << endl;
+    cout << "  Turn latency p99:       " << percentile(0.99) << " us" << endl;
+    cout << "  Turn latency max:       " << latencies.back() << " us" << endl;
+    cout << "  Throughput:             " << setprecision(0) << turnCount / (busyUs / 1e6) << " turns/s" << endl;
+    cout << "  Allocations per turn:   " << setprecision(1) << (double)allocationCount / turnCount
+        << " (" << (double)allocationBytes / turnCount << " bytes)" << endl;
+    noteUncountedAllocations();
+    cout << "  Reply bytes:            " << replyBytes << endl;
+    cout << "  Reply checksum:         " << hex << replyHash << dec << endl;
+    return 0;
+}
+
+//======================================================
+// FUNCTION: runSnapshotCheck
+// Aim: Pins snapshots on reader threads while the main
+//      thread publishes new ones back to back, and fails if a
+//      reader ever sees its pinned snapshot freed, or if no
+//      reader pinned while the publishes ran. Publishing
+//      starts once every reader has pinned. A freed
+//      probe is marked dead by its destructor; build with
+//      -fsanitize=address to catch any use after free too.
+//======================================================
+int runSnapshotCheck() {
+    static const uint64_t LIVE = 0x5EED5EED5EED5EEDull;
+    struct SnapshotProbe {
+        atomic<uint64_t> state;
+        uint64_t version;
+        SnapshotProbe(uint64_t number) : state(LIVE), version(number) {}
+        ~SnapshotProbe() { state.store(0); }
+    };
+
+    const int readerCount = 4;
+    const int publishCount = 2000;
+    SnapshotPointer<SnapshotProbe> pointer(new SnapshotProbe(0));
+    atomic<bool> stop(false);
+    atomic<long> failures(0);
+    atomic<long> pins(0);
+    atomic<int> started(0);     // readers that have pinned once
+    vector<thread> readers;
+    for (int r = 0; r < readerCount; r++) {
+        readers.emplace_back([&]() {
+            bool first = true;
+            while (!stop.load()) {
+                SnapshotPointer<SnapshotProbe>::Reader snapshot(pointer);
+                uint64_t version = snapshot->version;
+                this_thread::yield();
+                if (snapshot->state.load() != LIVE || snapshot->version != version) failures++;
+                pins++;
+                if (first) started++;
+                first = false;
+            }
+        });
+    }
+    while (started.load() < readerCount) this_thread::yield();
+    long pinsBefore = pins.load();
+    auto start = chrono::steady_clock::now();
+    for (int i = 1; i <= publishCount; i++) {
+        pointer.publish(new SnapshotProbe(i));
+    }
+    long pinsDuring = pins.load() - pinsBefore;
+    stop = true;
+    for (thread& reader : readers) reader.join();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << "  Publishes:   " << publishCount << " in " << fixed << setprecision(1) << ms << " ms" << endl;
+    cout << "  Reader pins: " << pinsDuring << " during the publishes on " << readerCount << " threads" << endl;
+    if (failures.load() != 0) {
+        cout << "  FAILED: " << failures.load() << " reads of a freed snapshot" << endl;
+        return 1;
+    }
+    if (pinsDuring == 0) {
+        cout << "  FAILED: no reader pinned while the publishes ran" << endl;
+        return 1;
+    }
+    cout << "  OK" << endl;
+    return 0;
+}
+
+//======================================================
+// CLASS: TurnInput
+// Purpose: In-memory console input handed out one line per
+//          underflow. Every line read ends the turn before it,
+//          so the allocations of each console turn are those
+//          between two reads.
+//======================================================
+class TurnInput : public streambuf {
+private:
+    string text;            // every line with its '\n'
+    vector<size_t> lineStart;
+    size_t next;
+    uint64_t mark;          // allocations when the current turn began
+
+protected:
+    int_type underflow() override {
+        endTurn();
+        if (next + 1 >= lineStart.size()) return traits_type::eof();
+        char* begin = &text[lineStart[next]];
+        char* end = &text[lineStart[next + 1]];
+        next++;
+        setg(begin, begin, end);
+        return traits_type::to_int_type(*begin);
+    }
+
+public:
+    uint64_t worst;         // most allocations of one turn
+
+    TurnInput(const char* const* lines, int count) : next(0), mark(0), worst(0) {
+        lineStart.push_back(0);
+        for (int i = 0; i < count; i++) {
+            text += lines[i];
+            text += '\n';
+            lineStart.push_back(text.size());
+        }
+    }
+
     //======================================================
-    // FUNCTION: stringToInt
-    // Aim: Converts string to integer
+    // FUNCTION: rewind
+    // Aim: Starts over at the first line with no turns counted
     //======================================================
-    int stringToInt(const string& str) {
-    return atoi(str.c_str());
-}
+    void rewind() {
+        next = 0;
+        setg(nullptr, nullptr, nullptr);
+        worst = 0;
+        mark = allocations.count;
+    }
 
     //======================================================
-    // FUNCTION: formatNumber
-    // Aim: Formats number with commas for better readability
+    // FUNCTION: endTurn
+    // Aim: Closes the turn in progress; also called after the
+    //      console loop returns, for the last one
     //======================================================
-    string formatNumber(double num) {
-    stringstream ss;
-    ss << fixed << setprecision(2) << num;
-    string result = ss.str();
+    void endTurn() {
+        worst = max(worst, allocations.count - mark);
+        mark = allocations.count;
+    }
+};
 
-    if (result.substr(result.length() - 3) == ".00") {
-        result = result.substr(0, result.length() - 3);
+//======================================================
+// FUNCTION: runAllocationCheck
+// Aim: Plays a scripted conversation through handleMessage
+//      and through the console loop (input from memory, output
+//      to the null device) after a warm-up round, and fails if
+//      any headless or console turn allocates more than the
+//      budget
+//======================================================
+int runAllocationCheck(LoanApplicationSystem& chatbot) {
+    if (!ALLOCATIONS_COUNTED) {
+        cout << "  FAILED: this build does not count allocations; rebuild with -DLOANBUDDY_ALLOC_COUNT" << endl;
+        return 1;
     }
+    const uint64_t budget = 2;      // heap allocations allowed per turn
+    const char* script[] = { "hi", "Hello there", "h", "1", "1", "24", "y", "n", "A", "h", "1", "0", "q", "x" };
+    const int turnCount = sizeof(script) / sizeof(script[0]);
 
-    int insertPos = result.find('.');
-    if (insertPos == string::npos) {
-        insertPos = result.length();
+    TurnArena arena;
+    SessionState state;
+    uint64_t worst = 0;
+    uint64_t total = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < turnCount; i++) {
+            string message = script[i];
+            AllocationCounter before = allocations;
+            arena.reset();
+            chatbot.handleMessage(state, message, arena);
+            uint64_t used = allocations.count - before.count;
+            if (round == 1) {
+                worst = max(worst, used);
+                total += used;
+            }
+        }
     }
-    insertPos -= 3;
 
-    while (insertPos > 0) {
-        result.insert(insertPos, ",");
-        insertPos -= 3;
+#ifdef _WIN32
+    FILE* sink = fopen("NUL", "wb");
+#else
+    FILE* sink = fopen("/dev/null", "wb");
+#endif
+    if (sink == nullptr) return 1;
+    chatbot.getScreen().redirect(sink, false);
+    TurnInput input(script, turnCount);
+    streambuf* original = cin.rdbuf(&input);
+    for (int round = 0; round < 2; round++) {
+        cin.clear();
+        input.rewind();
+        chatbot.run();
+        input.endTurn();
     }
+    cin.rdbuf(original);
+    cin.clear();
+    chatbot.getScreen().flush();
+    fclose(sink);
 
-    return result;
+    cout << fixed << setprecision(2);
+    cout << "  Headless turns:                " << turnCount << endl;
+    cout << "  Allocations per turn (max):    " << worst << endl;
+    cout << "  Allocations per turn (avg):    " << (double)total / turnCount << endl;
+    cout << "  Console allocations (max):      " << input.worst << endl;
+    if (worst > budget || input.worst > budget) {
+        cout << "  FAILED: budget is " << budget << " allocations per turn" << endl;
+        return 1;
+    }
+    cout << "  OK (budget " << budget << " per turn)" << endl;
+    return 0;
 }
 
-    //======================================================
-    // FUNCTION: calculateMonthlyInstallment
-    // Aim: Calculates monthly installment amount
-    //      Formula: (Price - Down Payment) / Number of Installments
-    //======================================================
-    double calculateMonthlyInstallment(double price, double downPayment, int installments) {
-    return (price - downPayment) / installments;
-}
+//======================================================
+// FUNCTION: runLookupBenchmark
+// Aim: Compares the hash index against the linear scan for
+//      10, 1k and 100k utterances (hits and misses mixed).
+//======================================================
+int runLookupBenchmark() {
+    const int sizes[] = { 10, 1000, 100000 };
 
-    //======================================================
-    // FUNCTION: resizeUtterances
-    // Aim: Expands the utterances array size dynamically
-    //      when capacity is reached.
-    //======================================================
-    void resizeUtterances() {
-        utteranceCapacity *= 2;
-        Utterance* newUtterances = new Utterance[utteranceCapacity];
-        for (int i = 0; i < utteranceCount; i++) {
-            newUtterances[i] = utterances[i];
+    cout << "  Utterances    Scan ns/lookup    Index ns/lookup    Speedup" << endl;
+    for (int s = 0; s < 3; s++) {
+        int n = sizes[s];
+        LoanApplicationSystem chatbot;
+        for (int i = 0; i < n; i++) {
+            chatbot.addUtterance("Utterance " + to_string(i), "Response " + to_string(i));
         }
-        delete[] utterances;
-        utterances = newUtterances;
-    }
-
-    //======================================================
-    // FUNCTION: resizeLoanArray
-    // Aim: Generic function to resize loan option arrays
-    //======================================================
-    void resizeLoanArray(LoanOption*& array, int& capacity) {
-     capacity *= 2;
-     LoanOption* newArray = new LoanOption[capacity];
-     for (int i = 0; i < capacity / 2; i++) {
-         newArray[i] = array[i];
-        }
-     delete[] array;
-     array = newArray;
- 
-    }
-
-    //======================================================
-    // FUNCTION: displayWelcomeScreen
-    // Aim: Displays an attractive welcome screen with chatbot name
-    //======================================================
-    void displayWelcomeScreen() {
-        system("cls");
-        setColor(LIGHT_CYAN);
-        cout << "\n";
-        cout << "  ========================================================\n";
-        cout << "  ||                                                    ||\n";
-        setColor(LIGHT_YELLOW);
-        cout << "  ||              WELCOME TO LOAN-BUDDY                 ||\n";
-        setColor(LIGHT_CYAN);
-        cout << "  ||                                                    ||\n";
-        setColor(MAGENTA);
-        cout << "  ||           Your Smart Loan Assistant                ||\n";
-        setColor(LIGHT_CYAN);
-        cout << "  ||                                                    ||\n";
-        cout << "  ========================================================\n";
-        setColor(WHITE);
-        cout << "\n";
-    }
-
-    //======================================================
-    // FUNCTION: displayGoodbyeScreen
-    // Aim: Displays a farewell message when user exits
-    //======================================================
-    void displayGoodbyeScreen() {
-        system("cls");
-        setColor(LIGHT_MAGENTA);
-        cout << "\n\n";
-        cout << "  ========================================================\n";
-        cout << "  ||                                                    ||\n";
-        setColor(LIGHT_YELLOW);
-        cout << "  ||                  BYE BYE! :)                       ||\n";
-        setColor(LIGHT_MAGENTA);
-        cout << "  ||                                                    ||\n";
-        setColor(LIGHT_GREEN);
-        cout << "  ||          Thank you for using LOAN-BUDDY!           ||\n";
-        setColor(LIGHT_MAGENTA);
-        cout << "  ||                                                    ||\n";
-        cout << "  ========================================================\n";
-        setColor(WHITE);
-        cout << "\n\n";
-        Sleep(2000); // Pause for 2 seconds
-    }
-
-    //======================================================
-    // FUNCTION: generateInstallmentPlan
-    // Aim: Generates and displays complete installment plan
-    //======================================================
-    void generateInstallmentPlan(const LoanOption& loan, const string& loanType, int userInstallments) {
-    double price = stringToDouble(loan.price);
-    double downPayment = stringToDouble(loan.downPayment);
-    int installments = userInstallments;
-
-    double monthlyAmount = calculateMonthlyInstallment(price, downPayment, installments);
-    double remainingBalance = price - downPayment;
-
-    setColor(LIGHT_CYAN);
-    cout << "\n  ========================================================" << endl;
-    setColor(LIGHT_YELLOW);
-    cout << "                  INSTALLMENT PLAN" << endl;
-    setColor(LIGHT_CYAN);
-    cout << "  ========================================================" << endl;
-    setColor(WHITE);
-
-    setColor(LIGHT_GREEN);
-    cout << "\n  Loan Summary:" << endl;
-    setColor(WHITE);
-    cout << "    Loan Type: " << loanType << endl;
-    cout << "    Category: " << loan.category << endl;
-    cout << "    Details: " << loan.details << endl;
-    cout << "    Total Price: Rs. " << formatNumber(price) << endl;
-    cout << "    Down Payment: Rs. " << formatNumber(downPayment) << endl;
-    cout << "    Loan Amount: Rs. " << formatNumber(remainingBalance) << endl;
-    cout << "    Number of Installments: " << installments << " months" << endl;
-    setColor(LIGHT_CYAN);
-    cout << "    Monthly Installment: Rs. " << formatNumber(monthlyAmount) << endl;
-    setColor(WHITE);
-
-    setColor(LIGHT_BLUE);
-    cout << "\n  --------------------------------------------------------" << endl;
-    setColor(LIGHT_YELLOW);
-    cout << "  Month      Monthly Payment      Remaining Balance" << endl;
-    setColor(LIGHT_BLUE);
-    cout << "  --------------------------------------------------------" << endl;
-    setColor(WHITE);
-
-    for (int month = 1; month <= installments; month++) {
-        cout << "  " << setw(5) << month << "      ";
-        setColor(LIGHT_GREEN);
-        cout << "Rs. " << setw(15) << left << formatNumber(monthlyAmount);
-        setColor(WHITE);
-        cout << "  ";
-
-        remainingBalance -= monthlyAmount;
-        if (remainingBalance < 0.01) remainingBalance = 0;
-
-        setColor(LIGHT_CYAN);
-        cout << "Rs. " << formatNumber(remainingBalance) << endl;
-        setColor(WHITE);
-    }
-
-    setColor(LIGHT_BLUE);
-    cout << "  --------------------------------------------------------" << endl;
-    setColor(LIGHT_GREEN);
-    cout << "\n  Total Amount Paid: Rs. " << formatNumber(price) << endl;
-    setColor(WHITE);
-}
-
-    //======================================================
-    // FUNCTION: getValidInput
-    // Aim: Gets valid input from user with custom validation
-    //======================================================
-    string getValidInput(const string& prompt, bool allowX = true) {
-        string input;
-        while (true) {
-            setColor(LIGHT_YELLOW);
-            cout << prompt;
-            setColor(BRIGHT_WHITE);
-            getline(cin, input);
-            input = trim(input);
-
-            if (input.empty()) {
-                setColor(LIGHT_RED);
-                cout << "Input cannot be empty. Please try again." << endl;
-                continue;
-            }
 
-            if (allowX && toLower(input) == "x") {
-                return "x";
-            }
-
-            return input;
+        // Every fourth query misses and falls through to the default
+        vector<string> queries;
+        for (int i = 0; i < 1024; i++) {
+            int key = (int)((i * 2654435761u) % (unsigned)n);
+            queries.push_back(i % 4 == 3 ? "unknown " + to_string(i) : "utterance " + to_string(key));
         }
-    }
 
-    //======================================================
-    // FUNCTION: getValidNumberInput
-    // Aim: Gets valid numeric input from user
-    //======================================================
-    int getValidNumberInput(const string& prompt, int min, int max) {
-        string input;
-        while (true) {
-            setColor(LIGHT_MAGENTA);
-            cout << prompt;
-            setColor(BRIGHT_WHITE);
-            getline(cin, input);
-            input = trim(input);
-
-            if (input.empty()) {
-                setColor(LIGHT_RED);
-                cout << "  Input cannot be empty. Please try again." << endl;
-                continue;
+        for (size_t i = 0; i < queries.size(); i++) {
+            if (chatbot.getResponse(queries[i]) != chatbot.scanResponse(queries[i])) {
+                cerr << "Index and scan disagree on '" << queries[i] << "'" << endl;
+                return 1;
             }
+        }
 
-            if (!isValidNumber(input)) {
-                setColor(LIGHT_RED);
-                cout << "  Invalid input! Please enter a number between " << min << " and " << max << "." << endl;
-                continue;
-            }
+        int scanRounds = n >= 100000 ? 2000 : 200000;
+        int indexRounds = 200000;
+        size_t sink = 0;
 
-            int value = stringToInt(input);
-            if (value < min || value > max) {
-                setColor(LIGHT_RED);
-                cout << "  Invalid option! Please enter a number between " << min << " and " << max << "." << endl;
-                continue;
-            }
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < scanRounds; i++) {
+            sink += chatbot.scanResponse(queries[i & 1023]).size();
+        }
+        double scanNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / scanRounds;
 
-            return value;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < indexRounds; i++) {
+            sink += chatbot.getResponse(queries[i & 1023]).size();
         }
+        double indexNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / indexRounds;
+
+        cout << "  " << setw(10) << n << "    " << setw(14) << fixed << setprecision(1) << scanNs
+            << "    " << setw(15) << indexNs << "    " << setw(6) << scanNs / indexNs << "x"
+            << (sink == 0 ? " " : "") << endl;
     }
+    return 0;
+}
 
-    //======================================================
-    // FUNCTION: displayLoanOptions
-    // Aim: Displays all loan options for specific type and category
-    //======================================================
-    int displayLoanOptions(LoanOption* options, int count, const string& category, const string& loanType) {
-    setColor(LIGHT_CYAN);
-    cout << "\n  ========================================================" << endl;
-    setColor(LIGHT_YELLOW);
-    cout << "          " << loanType << " Loan Options - " << category << endl;
-    setColor(LIGHT_CYAN);
-    cout << "  ========================================================" << endl;
-    setColor(WHITE);
+//======================================================
+// FUNCTION: runMatchBenchmark
+// Aim: Times getResponse on 100k generated utterances for
+//      exact inputs, inputs with an extra word, inputs with a
+//      typo and unrelated inputs, and counts correct answers
+//======================================================
+int runMatchBenchmark() {
+    const int utteranceCount = 100000;
+    const int vocabularySize = 20000;
 
-    int optionNum = 0;
-    for (int i = 0; i < count; i++) {
-        if (toLower(options[i].category) == toLower(category)) {
-            optionNum++;
-
-            double price = stringToDouble(options[i].price);
-            double downPayment = stringToDouble(options[i].downPayment);
-
-            setColor(LIGHT_YELLOW);
-            cout << "\n  Option " << optionNum << ":" << endl;
-            setColor(LIGHT_GREEN);
-            cout << "    Category: ";
-            setColor(BRIGHT_WHITE);
-            cout << options[i].category << endl;
-            setColor(LIGHT_GREEN);
-            cout << "    Details: ";
-            setColor(BRIGHT_WHITE);
-            cout << options[i].details << endl;
-            setColor(LIGHT_GREEN);
-            cout << "    Price: ";
-            setColor(LIGHT_CYAN);
-            cout << "Rs. " << formatNumber(price) << endl;
-            setColor(LIGHT_GREEN);
-            cout << "    Down Payment: ";
-            setColor(LIGHT_CYAN);
-            cout << "Rs. " << formatNumber(downPayment) << endl;
-            setColor(LIGHT_GREEN);
-            cout << "    Available Installment Plans: ";
-            setColor(BRIGHT_WHITE);
-            cout << options[i].installments << " months (or custom)" << endl;
-            setColor(LIGHT_BLUE);
-            cout << "  --------------------------------------------------------" << endl;
-            setColor(WHITE);
-        }
-    }
-
-    if (optionNum == 0) {
-        setColor(LIGHT_RED);
-        cout << "  No loan options available for " << category << endl;
-        setColor(WHITE);
-    }
-
-    return optionNum;
-}
-
-    //======================================================
-    // FUNCTION: selectAndShowInstallmentPlan
-    // Aim: Allows user to select option, choose installments, and view plan
-    //======================================================
-    void selectAndShowInstallmentPlan(LoanOption* options, int count, const string& category, const string& loanType, int displayedCount) {
-    if (displayedCount == 0) {
-        return;
+    // Pseudo-words of 4-9 letters from a fixed seed
+    unsigned seed = 12345;
+    auto nextRandom = [&seed]() { seed = seed * 1103515245u + 12345u; return (seed >> 8) & 0xFFFFFF; };
+    vector<string> words(vocabularySize);
+    for (int w = 0; w < vocabularySize; w++) {
+        int length = 4 + (int)(nextRandom() % 6);
+        for (int i = 0; i < length; i++) words[w] += (char)('a' + nextRandom() % 26);
     }
 
-    int selection = getValidNumberInput("\n  Enter option number to view installment plan (1-" +
-        to_string(displayedCount) + "), or 0 to skip: ", 0, displayedCount);
-
-    if (selection == 0) {
-        return;
+    LoanApplicationSystem chatbot;
+    vector<string> inputs(utteranceCount);
+    for (int i = 0; i < utteranceCount; i++) {
+        int length = 2 + (int)(nextRandom() % 4);
+        for (int k = 0; k < length; k++) {
+            inputs[i] += (k ? " " : "") + words[nextRandom() % vocabularySize];
+        }
+        chatbot.addUtterance(inputs[i], "Response " + to_string(i));
     }
+    auto start = chrono::steady_clock::now();
+    chatbot.buildMatcher();
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-    // Find the selected loan option
-    int currentOption = 0;
-    LoanOption selectedLoan;
-    for (int i = 0; i < count; i++) {
-        if (toLower(options[i].category) == toLower(category)) {
-            currentOption++;
-            if (currentOption == selection) {
-                selectedLoan = options[i];
-                break;
+    const char* kinds[] = { "Exact", "Extra word", "Typo", "Unrelated" };
+    cout << "  Built index over " << utteranceCount << " utterances in " << fixed << setprecision(1) << buildMs << " ms" << endl;
+    cout << "  Query          us/query    Answered as expected" << endl;
+    for (int kind = 0; kind < 4; kind++) {
+        const int queryCount = 2000;
+        vector<string> queries(queryCount);
+        vector<string> expected(queryCount);
+        for (int q = 0; q < queryCount; q++) {
+            int source = (int)(nextRandom() % utteranceCount);
+            string query = inputs[source];
+            expected[q] = "Response " + to_string(source);
+            if (kind == 1) {
+                query += " please";
+            }
+            else if (kind == 2) {
+                size_t space = query.find(' ');
+                size_t at = (space == string::npos ? query.size() : space) / 2;
+                query[at] = query[at] == 'z' ? 'y' : query[at] + 1;
             }
+            else if (kind == 3) {
+                query = "zq" + to_string(q) + " xv" + to_string(q);
+                expected[q] = chatbot.getResponse("*");
+            }
+            queries[q] = query;
+        }
+
+        int correct = 0;
+        start = chrono::steady_clock::now();
+        for (int q = 0; q < queryCount; q++) {
+            correct += chatbot.getResponse(queries[q]) == expected[q];
         }
+        double usPerQuery = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / queryCount;
+        cout << "  " << left << setw(12) << kinds[kind] << right << setw(10) << setprecision(2) << usPerQuery
+            << "    " << setw(10) << setprecision(1) << 100.0 * correct / queryCount << "%" << endl;
     }
+    return 0;
+}
 
-    // Show available installment options and let user choose
-    setColor(LIGHT_CYAN);
-    cout << "\n  ========================================================" << endl;
-    setColor(LIGHT_YELLOW);
-    cout << "              SELECT NUMBER OF INSTALLMENTS" << endl;
-    setColor(LIGHT_CYAN);
-    cout << "  ========================================================" << endl;
-    setColor(WHITE);
-
-    double price = stringToDouble(selectedLoan.price);
-    double downPayment = stringToDouble(selectedLoan.downPayment);
-
-    setColor(LIGHT_GREEN);
-    cout << "\n  Suggested installment plans for this loan:" << endl;
-    setColor(WHITE);
-
-    int suggestedInstallments = stringToInt(selectedLoan.installments);
-    double suggestedMonthly = calculateMonthlyInstallment(price, downPayment, suggestedInstallments);
-
-    setColor(LIGHT_YELLOW);
-    cout << "    Suggested: " << suggestedInstallments << " months ";
-    setColor(WHITE);
-    cout << "=> Monthly Payment: ";
-    setColor(LIGHT_CYAN);
-    cout << "Rs. " << formatNumber(suggestedMonthly) << endl;
-    setColor(WHITE);
-
-    // Show some common alternatives
-    int alternatives[] = { 12, 24, 36, 48, 60 };
-    setColor(LIGHT_GREEN);
-    cout << "\n  Common alternatives:" << endl;
-    setColor(WHITE);
-
-    for (int i = 0; i < 5; i++) {
-        if (alternatives[i] != suggestedInstallments) {
-            double altMonthly = calculateMonthlyInstallment(price, downPayment, alternatives[i]);
-            setColor(LIGHT_YELLOW);
-            cout << "    " << alternatives[i] << " months ";
-            setColor(WHITE);
-            cout << "=> Monthly Payment: ";
-            setColor(LIGHT_CYAN);
-            cout << "Rs. " << formatNumber(altMonthly) << endl;
-            setColor(WHITE);
-        }
-    }
-
-    // Get user's choice
-    setColor(LIGHT_MAGENTA);
-    cout << "\n  Enter your preferred number of installments (1-120 months): ";
-    setColor(BRIGHT_WHITE);
-
-    int userInstallments = getValidNumberInput("", 1, 120);
-
-    // Calculate and display monthly installment
-    double monthlyAmount = calculateMonthlyInstallment(price, downPayment, userInstallments);
-
-    setColor(LIGHT_CYAN);
-    cout << "\n  ========================================================" << endl;
-    setColor(LIGHT_YELLOW);
-    cout << "               YOUR MONTHLY INSTALLMENT" << endl;
-    setColor(LIGHT_CYAN);
-    cout << "  ========================================================" << endl;
-    setColor(LIGHT_GREEN);
-    cout << "\n  For " << userInstallments << " months, your monthly payment will be: ";
-    setColor(LIGHT_YELLOW);
-    cout << "Rs. " << formatNumber(monthlyAmount) << endl;
-    setColor(WHITE);
-
-    // Ask if user wants detailed installment plan
-    setColor(LIGHT_MAGENTA);
-    cout << "\n  Would you like to see a detailed installment plan? (Y/N): ";
-    setColor(BRIGHT_WHITE);
+//======================================================
+// FUNCTION: runNormalizeBenchmark
+// Aim: Times input normalization with the synonyms of
+//      Synonyms.txt and the built-in ones on folded ASCII, mixed-case punctuated
+//      ASCII, Roman-Urdu and Urdu-script messages, and reports
+//      the heap allocations per message
+//======================================================
+int runNormalizeBenchmark() {
+    TextNormalizer normalizer;
+    StringArena files;
+    string_view table;
+    files.map("Synonyms.txt", table);
+    normalizer.build(table, EMBEDDED_SYNONYMS, EMBEDDED_SYNONYM_COUNT);
 
-    string response;
-    getline(cin, response);
-    response = trim(response);
+    const char* kinds[] = { "Folded ASCII", "Mixed ASCII", "Roman Urdu", "Urdu script" };
+    const char* messages[4][3] = {
+        { "hi", "home down 20 lakh monthly 150k", "i want to apply for a loan" },
+        { "Hello There!", "HOME, down: 20 Lakh; monthly 150k", "I'd like to apply -- for a LOAN?" },
+        { "Assalam-o-Alaikum", "Salaam, kya haal hai", "AoA! loan chahiye" },
+        { "السلام عليكم", "سلام، قرض چاہیے", "ہیلو۔ گھر کا قرض" },
+    };
+    const int rounds = 200000;
 
-    if (toLower(response) == "y" || toLower(response) == "yes") {
-        generateInstallmentPlan(selectedLoan, loanType, userInstallments);
+    cout << "  " << normalizer.synonymCount() << " synonyms" << endl;
+    cout << "  Input           ns/message    Allocations/message    Example" << endl;
+    TurnArena arena;
+    for (int kind = 0; kind < 4; kind++) {
+        size_t checksum = 0;
+        AllocationCounter before = allocations;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            arena.reset();
+            checksum += normalizer.apply(messages[kind][r % 3], arena).size();
+        }
+        double nsPerMessage = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / rounds;
+        uint64_t used = allocations.count - before.count;
+        arena.reset();
+        cout << "  " << left << setw(14) << kinds[kind] << right << fixed << setprecision(1) << setw(12) << nsPerMessage
+            << "    " << setw(19) << setprecision(3) << (double)used / rounds
+            << "    \"" << normalizer.apply(messages[kind][0], arena) << "\"" << endl;
+        if (checksum == 0) return 1;
     }
+    noteUncountedAllocations();
+    return 0;
 }
 
-    //======================================================
-    // FUNCTION: handleLoanSelection
-    // Aim: Generic function to handle loan selection for any type
-    //======================================================
-    void handleLoanSelection(LoanOption* options, int count, const string& loanType) {
-    // Get unique categories
-    string categories[100];
-    int categoryCount = 0;
-
+//======================================================
+// FUNCTION: runQuoteBenchmark
+// Aim: Quotes one million generated options the way a catalog
+//      load does (QuoteTable::build, one panel per loan amount
+//      and term) and one ScheduleCursor per option and term,
+//      checks that every paisa agrees, and reports quotes per
+//      second
+//======================================================
+int runQuoteBenchmark() {
+    const int count = 1000000;
+    const double rate = 12;
+    vector<LoanOption> options(count);
     for (int i = 0; i < count; i++) {
-        bool found = false;
-        for (int j = 0; j < categoryCount; j++) {
-            if (categories[j] == options[i].category) {
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            categories[categoryCount++] = options[i].category;
-        }
+        double price = 1000000.0 + (i % 997) * 25000.0;
+        options[i].priceValue = Money::fromRupees(price);
+        options[i].downPaymentValue = Money::fromRupees(price * (0.1 + (i % 5) * 0.05));
+        options[i].installmentCount = 6 + (i % 115);
     }
 
-    if (categoryCount == 0) {
-        setColor(LIGHT_RED);
-        cout << "\n  No " << loanType << " loan options available at this time." << endl;
-        setColor(WHITE);
-        return;
-    }
+    QuoteTable table;
+    auto start = chrono::steady_clock::now();
+    table.build(options.data(), count, rate, GROUP_WESTERN);
+    double tableSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    // Display categories
-    setColor(LIGHT_CYAN);
-    cout << "\n  Available " << loanType << " Categories:" << endl;
-    setColor(WHITE);
-    for (int i = 0; i < categoryCount; i++) {
-        setColor(LIGHT_GREEN);
-        cout << "    " << (i + 1) << ". " << categories[i] << endl;
+    vector<Money> scalar((size_t)count * QUOTE_SLOTS);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        Money principal = options[i].priceValue - options[i].downPaymentValue;
+        for (int slot = 0; slot < QUOTE_SLOTS; slot++) {
+            int months = slot == 0 ? options[i].installmentCount : STANDARD_TERMS[slot - 1];
+            scalar[(size_t)i * QUOTE_SLOTS + slot] = ScheduleCursor(principal, rate, months).monthly();
+        }
     }
-    setColor(WHITE);
-
-    int selection = getValidNumberInput("\n  Select category (1-" + to_string(categoryCount) + "): ",
-        1, categoryCount);
-
-    string selectedCategory = categories[selection - 1];
-    int displayedCount = displayLoanOptions(options, count, selectedCategory, loanType);
-    selectAndShowInstallmentPlan(options, count, selectedCategory, loanType, displayedCount);
-}
-public:
-    //======================================================
-    // CONSTRUCTOR: LoanApplicationSystem
-    // Aim: Initializes data members and allocates memory
-    //======================================================
-    LoanApplicationSystem() {
-    utteranceCapacity = 10;
-    utteranceCount = 0;
-    utterances = new Utterance[utteranceCapacity];
-
-    homeCapacity = 10;
-    homeCount = 0;
-    homeLoanOptions = new LoanOption[homeCapacity];
+    double scalarSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    carCapacity = 10;
-    carCount = 0;
-    carLoanOptions = new LoanOption[carCapacity];
-
-    bikeCapacity = 10;
-    bikeCount = 0;
-    bikeLoanOptions = new LoanOption[bikeCapacity];
+    for (int i = 0; i < count; i++) {
+        const QuotePanel* panel = table.find(i, rate, GROUP_WESTERN);
+        for (int slot = 0; slot < QUOTE_SLOTS; slot++) {
+            if (panel == nullptr || panel->monthly[slot] != scalar[(size_t)i * QUOTE_SLOTS + slot]) {
+                cerr << "Table and scalar quotes disagree at option " << i << endl;
+                return 1;
+            }
+        }
+    }
 
-    defaultResponse = "";
-    chatbotName = "LOAN-BUDDY";
+    double quotes = (double)count * QUOTE_SLOTS;
+    cout << fixed << setprecision(0);
+    cout << "  Options:                    " << count << " (" << table.panelCount() << " distinct loans)" << endl;
+    cout << "  Table quotes per second:    " << quotes / tableSeconds << endl;
+    cout << "  Scalar quotes per second:   " << quotes / scalarSeconds << endl;
+    return 0;
 }
 
-    //======================================================
-    // DESTRUCTOR: ~LoanApplicationSystem
-    // Aim: Frees dynamically allocated memory
-    //======================================================
-    ~LoanApplicationSystem() {
-    delete[] utterances;
-    delete[] homeLoanOptions;
-    delete[] carLoanOptions;
-    delete[] bikeLoanOptions;
-}
+//======================================================
+// FUNCTION: runFilterBenchmark
+// Aim: Runs affordability queries over two million generated
+//      options through OptionColumns and through a plain loop
+//      over the LoanOption records (one ScheduleCursor and
+//      branch per row, then a full sort), checks that both find
+//      the same options, and reports rows scanned per second
+//======================================================
+int runFilterBenchmark() {
+    const int count = 2000000;
+    const double rate = 12;
+    vector<LoanOption> options(count);
+    for (int i = 0; i < count; i++) {
+        double price = 2000000.0 + (i % 9973) * 5000.0;
+        options[i].priceValue = Money::fromRupees(price);
+        options[i].downPaymentValue = Money::fromRupees(price * (0.1 + (i % 7) * 0.05));
+        options[i].installmentCount = 12 + (i % 29) * 12 % 349;
+    }
+    OptionColumns columns;
+    columns.build(options.data(), count, rate);
 
-    //======================================================
-    // FUNCTION: loadUtterances
-    // Aim: Loads chatbot input-response pairs from file.
-    //      Stores default response if input is '*'.
-    //======================================================
-    bool loadUtterances(const string& filename) {
-        ifstream file(filename);
-        if (!file.is_open()) {
-            setColor(LIGHT_RED);
-            cerr << "Error: Could not open " << filename << endl;
-            setColor(WHITE);
-            return false;
-        }
+    FilterQuery queries[3];
+    queries[0].maxDownPayment = 2000000; queries[0].maxMonthly = 150000; queries[0].months = 60;
+    queries[1].maxDownPayment = 3000000; queries[1].maxMonthly = 60000;
+    queries[2].maxPrice = 2500000; queries[2].months = 120;
+    const char* names[3] = { "down+monthly, 60 months", "down+monthly, suggested", "price, 120 months" };
+    const int repeats = 20;
 
-        string line;
-        while (getline(file, line)) {
-            size_t pos = line.find('#');
-            if (pos != string::npos) {
-                string input = trim(line.substr(0, pos));
-                string response = trim(line.substr(pos + 1));
+    cout << fixed;
+    for (int q = 0; q < 3; q++) {
+        const FilterQuery& query = queries[q];
+        FilterResult result;
+        columns.filter(query, 0, count, result);
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++) columns.filter(query, 0, count, result);
+        double columnMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repeats;
 
-                if (input == "*") {
-                    defaultResponse = response;
-                }
-                else {
-                    if (utteranceCount >= utteranceCapacity) {
-                        resizeUtterances();
-                    }
-                    utterances[utteranceCount].input = toLower(input);
-                    utterances[utteranceCount].response = response;
-                    utteranceCount++;
+        vector<pair<int64_t, int>> matches;
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++) {
+            matches.clear();
+            for (int i = 0; i < count; i++) {
+                const LoanOption& option = options[i];
+                int months = query.months > 0 ? query.months : option.installmentCount;
+                ScheduleCursor plan(option.priceValue - option.downPaymentValue, rate, months);
+                if (option.downPaymentValue <= Money::fromRupees(query.maxDownPayment) &&
+                    plan.monthly() <= Money::fromRupees(query.maxMonthly) &&
+                    option.priceValue <= Money::fromRupees(query.maxPrice)) {
+                    matches.push_back(make_pair((option.downPaymentValue + plan.totalPaid()).paisa, i));
                 }
             }
+            sort(matches.begin(), matches.end());
         }
-        file.close();
-        return true;
+        double loopMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repeats;
+
+        bool same = (int)matches.size() == result.matches;
+        for (int k = 0; same && k < result.shown; k++) {
+            same = matches[k].second == result.rows[k] && matches[k].first == result.totalCost[k].paisa;
+        }
+        cout << "  " << left << setw(26) << names[q] << right << setprecision(0) << setw(8) << result.matches << " matches  "
+            << setprecision(2) << setw(7) << columnMs << " ms (" << setprecision(0) << setw(5) << count / columnMs / 1000
+            << " M rows/s)  loop " << setprecision(2) << setw(7) << loopMs << " ms" << (same ? "" : "  MISMATCH") << endl;
+        if (!same) return 1;
     }
-    //======================================================
-    // FUNCTION: loadLoanData
-    // Aim: Generic function to load loan data from file
-    //======================================================
-    bool loadLoanData(const string& filename, LoanOption*& options, int& count, int& capacity) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        setColor(LIGHT_RED);
-        cerr << "Error: Could not open " << filename << endl;
-        setColor(WHITE);
-        return false;
+    return 0;
+}
+
+//======================================================
+// FUNCTION: legacyFormatNumber
+// Aim: The original stringstream formatter, kept as the
+//      reference output and speed for runFormatBenchmark
+//======================================================
+string legacyFormatNumber(double num) {
+    stringstream ss;
+    ss << fixed << setprecision(2) << num;
+    string result = ss.str();
+
+    if (result.substr(result.length() - 3) == ".00") {
+        result = result.substr(0, result.length() - 3);
     }
 
-    string line;
-    bool firstLine = true;
+    size_t insertPos = result.find('.');
+    if (insertPos == string::npos) {
+        insertPos = result.length();
+    }
 
-    while (getline(file, line)) {
-        if (firstLine) {
-            firstLine = false;
-            continue;
-        }
+    while (insertPos > 3) {
+        insertPos -= 3;
+        result.insert(insertPos, ",");
+    }
 
-        if (line.empty() || trim(line).empty()) {
-            continue;
-        }
+    return result;
+}
 
-        if (count >= capacity) {
-            resizeLoanArray(options, capacity);
+//======================================================
+// FUNCTION: runFormatBenchmark
+// Aim: Formats one million amounts (whole rupees, paisa and
+//      installment quotients) with the legacy stringstream
+//      formatter and with formatAmount, checks that they
+//      agree, and reports time and heap allocations per call.
+//      Exact half-paisa ties differ on purpose: printf rounds
+//      them to even, formatAmount away from zero.
+//======================================================
+int runFormatBenchmark() {
+    const int count = 1000000;
+    vector<double> amounts(count);
+    for (int i = 0; i < count; i++) {
+        double price = 50000.0 + (double)(i % 9973) * 12345.0;
+        switch (i % 3) {
+        case 0: amounts[i] = price; break;
+        case 1: amounts[i] = price + (i % 100) / 100.0; break;
+        default: amounts[i] = price / (6 + i % 115); break;
         }
+    }
 
-        stringstream ss(line);
-        getline(ss, options[count].category, '#');
-        getline(ss, options[count].details, '#');
-        getline(ss, options[count].installments, '#');
-        getline(ss, options[count].price, '#');
-        getline(ss, options[count].downPayment, '#');
+    int mismatches = 0, ties = 0;
+    for (int i = 0; i < count; i += 97) {
+        if (legacyFormatNumber(amounts[i]) == string_view(formatAmount(amounts[i]))) continue;
+        double scaled = amounts[i] * 100;
+        if (scaled - floor(scaled) == 0.5) ties++;
+        else mismatches++;
+    }
 
-        options[count].category = trim(options[count].category);
-        options[count].details = trim(options[count].details);
-        options[count].installments = trim(options[count].installments);
-        options[count].price = trim(options[count].price);
-        options[count].downPayment = trim(options[count].downPayment);
+    size_t sink = 0;
+    uint64_t allocationsBefore = allocations.count;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) sink += legacyFormatNumber(amounts[i]).size();
+    double legacyNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+    double legacyAllocations = (double)(allocations.count - allocationsBefore) / count;
 
-        count++;
+    double ns[2];
+    allocationsBefore = allocations.count;
+    for (int grouping = GROUP_WESTERN; grouping <= GROUP_LAKH; grouping++) {
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) sink += formatAmount(amounts[i], (DigitGrouping)grouping).length;
+        ns[grouping] = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
     }
-    file.close();
-    return true;
-}
-    //======================================================
-    // FUNCTION: loadHomeLoanData
-    // Aim: Loads home loan data from file
-    //======================================================
-    bool loadHomeLoanData(const string& filename) {
-    return loadLoanData(filename, homeLoanOptions, homeCount, homeCapacity);
-}
+    double allocationsPerCall = (double)(allocations.count - allocationsBefore) / (2.0 * count);
 
-    //======================================================
-    // FUNCTION: loadCarLoanData
-    // Aim: Loads car loan data from file
-    //======================================================
-    bool loadCarLoanData(const string& filename) {
-    return loadLoanData(filename, carLoanOptions, carCount, carCapacity);
+    cout << fixed << setprecision(2);
+    cout << "  Legacy stringstream:    " << legacyNs << " ns/call, " << legacyAllocations << " allocations/call" << endl;
+    cout << "  formatAmount (Western): " << ns[GROUP_WESTERN] << " ns/call" << endl;
+    cout << "  formatAmount (lakh):    " << ns[GROUP_LAKH] << " ns/call" << endl;
+    cout << "  formatAmount allocations per call: " << allocationsPerCall << endl;
+    noteUncountedAllocations();
+    cout << "  Mismatches against legacy: " << mismatches << " of " << (count + 96) / 97
+        << " (" << ties << " half-paisa ties rounded up)" << endl;
+    cout << "  12345678.5 -> " << string_view(formatAmount(12345678.5))
+        << " / " << string_view(formatAmount(12345678.5, GROUP_LAKH)) << "   (" << sink % 10 << ")" << endl;
+    return mismatches == 0 ? 0 : 1;
 }
 
-    //======================================================
-    // FUNCTION: loadBikeLoanData
-    // Aim: Loads electric bike loan data from file
-    //======================================================
-    bool loadBikeLoanData(const string& filename) {
-    return loadLoanData(filename, bikeLoanOptions, bikeCount, bikeCapacity);
+//======================================================
+// FUNCTION: argumentValue
+// Aim: Returns the value following name on the command
+//      line (e.g. --rate 12), or nullptr
+//======================================================
+const char* argumentValue(int argc, char* argv[], const char* name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return nullptr;
 }
-    //======================================================
-    // FUNCTION: getResponse
-    // Aim: Returns chatbot response for user input by
-    //      matching against stored utterances.
-    //======================================================
-    string getResponse(const string& input) {
-        string lowerInput = toLower(trim(input));
-
-        for (int i = 0; i < utteranceCount; i++) {
-            if (utterances[i].input == lowerInput) {
-                return utterances[i].response;
-            }
-        }
-        return defaultResponse;
-    }   
 
-    //======================================================
-    // FUNCTION: run
-    // Aim: Runs the chatbot application loop.
-    //      Handles user input, area selection, and system exit.
-    //======================================================
-    void run() {
-        string input;
-        bool running = true;
+//======================================================
+// FUNCTION: runRenderBenchmark
+// Aim: Renders the home option and plan screens to the null
+//      device with colors on and reports write calls per
+//      screen against the old per-setColor/per-endl console
+//      calls (2 Win32 calls per setColor, 1 flush per endl).
+//======================================================
+int runRenderBenchmark() {
+    LoanApplicationSystem chatbot;
+    if (!chatbot.loadCatalog({ "Utterances.txt", "Products.txt", "", "Synonyms.txt" })) return 1;
 
-        displayWelcomeScreen();
+#ifdef _WIN32
+    FILE* sink = fopen("NUL", "wb");
+#else
+    FILE* sink = fopen("/dev/null", "wb");
+#endif
+    if (sink == nullptr) return 1;
 
-        setColor(LIGHT_CYAN);
-        cout << chatbotName << ": ";
-        setColor(MAGENTA);
-        cout << getResponse("hi") << endl;
-        setColor(WHITE);
+    Screen& screen = chatbot.getScreen();
+    screen.redirect(sink, true);
 
-        while (running) {
-            setColor(LIGHT_YELLOW);
-            cout << "\nYou: ";
-            setColor(BRIGHT_WHITE);
-            getline(cin, input);
-            input = trim(input);
+    const int rounds = 1000;
+    int screens = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        screens += chatbot.renderBenchmarkScreens();
+    }
+    double usPerScreen = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / max(screens, 1);
+    fclose(sink);
 
-            if (input.empty()) continue;
+    if (screens == 0) {
+        cerr << "No home loan options to render" << endl;
+        return 1;
+    }
+    double legacyCalls = (2.0 * screen.colorRequests + screen.lineBreaks) / screens;
+    cout << fixed << setprecision(1);
+    cout << "  Screens rendered:                 " << screens << endl;
+    cout << "  Write calls per screen:           " << (double)screen.writeCalls / screens << endl;
+    cout << "  Color codes emitted per screen:   " << (double)screen.colorCodes / screens << endl;
+    cout << "  Old console calls per screen:     " << legacyCalls << endl;
+    cout << "  Render time per screen:           " << usPerScreen << " us" << endl;
+    return 0;
+}
 
-            string lowerInput = toLower(input);
+//======================================================
+// FUNCTION: compileCatalog
+// Aim: Parses the text data files and writes them as one
+//      binary catalog image
+//======================================================
+int compileCatalog(const string& output) {
+    LoanApplicationSystem chatbot;
+    auto start = chrono::steady_clock::now();
+    if (!chatbot.loadCatalog({ "Utterances.txt", "Products.txt", "", "Synonyms.txt" })) return 1;
+    double parseMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-            if (lowerInput == "x") {
-                displayGoodbyeScreen();
-                running = false;
-                continue;
-            }
-            string response = getResponse(input);
+    if (!chatbot.compileCatalog(output)) {
+        cerr << "Error: Could not write " << output << endl;
+        return 1;
+    }
 
-            setColor(LIGHT_CYAN);
-            cout << "\n" << chatbotName << ": ";
-            setColor(LIGHT_GREEN);
-            cout << response << endl;
-            setColor(WHITE);
+    // Time opening the image the way startup will
+    start = chrono::steady_clock::now();
+    Catalog image;
+    if (!image.loadImage(output)) {
+        cerr << "Error: " << output << " does not read back" << endl;
+        return 1;
+    }
+    double imageMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-           // Handle loan type selection
-        if (lowerInput == "h") {
-            handleLoanSelection(homeLoanOptions, homeCount, "Home");
+    cout << fixed << setprecision(1);
+    cout << "  Wrote " << output << ": " << image.utteranceCount << " utterances, "
+        << image.productCount << " products, " << image.loanOptionCount << " loan options" << endl;
+    cout << "  Text load:  " << parseMs << " ms" << endl;
+    cout << "  Image load: " << imageMs << " ms" << endl;
+    return 0;
+}
 
-            setColor(LIGHT_MAGENTA);
-            cout << "\nPress X to exit or any other key to continue: ";
-            setColor(BRIGHT_WHITE);
-            getline(cin, input);
-            if (toLower(trim(input)) == "x") {
-                displayGoodbyeScreen();
-                running = false;
-            }
-        }
-        else if (lowerInput == "c") {
-            if (carCount > 0) {
-                handleLoanSelection(carLoanOptions, carCount, "Car");
-            }
-            else {
-                setColor(LIGHT_YELLOW);
-                cout << "(Car loan options will be available in future updates)" << endl;
-                setColor(WHITE);
-            }
+//======================================================
+// FUNCTION: runLoadBenchmark
+// Aim: Writes a generated catalog (one large loan table, two
+//      smaller ones and many utterances) to a temporary
+//      directory and times loading it from the text files
+//      with 1, 2, 4, ... threads up to maxThreads (default:
+//      the core count). The
+//      files stay in the page cache, so this measures parsing
+//      and indexing, not the disk.
+//======================================================
+int runLoadBenchmark(int maxThreads) {
+    error_code error;
+    filesystem::path directory = filesystem::temp_directory_path(error) / ("loanbuddy-bench-load-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    if (error || !filesystem::create_directories(directory, error)) {
+        cerr << "Error: cannot create a temporary directory" << endl;
+        return 1;
+    }
 
-            setColor(LIGHT_MAGENTA);
-            cout << "\nPress X to exit or any other key to continue: ";
-            setColor(BRIGHT_WHITE);
-            getline(cin, input);
-            if (toLower(trim(input)) == "x") {
-                displayGoodbyeScreen();
-                running = false;
-            }
+    const char* names[3] = { "Home", "Car", "Bike" };
+    const int rows[3] = { 1500000, 300000, 200000 };
+    const int utterances = 50000;
+    string products;
+    string text;
+    for (int t = 0; t < 3; t++) {
+        string file = (directory / (string(names[t]) + ".txt")).string();
+        products += string(1, names[t][0]) + "#" + names[t] + "#" + file + "#\n";
+        text = "Region#Details#Installments#Price#Down Payment\n";
+        char line[160];
+        for (int i = 0; i < rows[t]; i++) {
+            long long price = 500000 + (i % 9973) * 2500LL;
+            text.append(line, snprintf(line, sizeof(line), "Region %d#Option %d, %d sq ft#%d#%lld.50#%lld\n",
+                i % 40, i, 500 + i % 3000, 12 + (i % 30) * 12, price, price / 5));
         }
-        else if (lowerInput == "e" || lowerInput == "b") {
-            if (bikeCount > 0) {
-                handleLoanSelection(bikeLoanOptions, bikeCount, "Electric Bike");
-            }
-            else {
-                setColor(LIGHT_YELLOW);
-                cout << "(Electric bike loan options will be available in future updates)" << endl;
-                setColor(WHITE);
-            }
+        ofstream(file, ios::binary) << text;
+    }
+    text.clear();
+    for (int i = 0; i < utterances; i++) {
+        text += "question number " + to_string(i) + " about loans#Answer " + to_string(i) + "\n";
+    }
+    text += "*#I did not understand that\n";
+    CatalogFiles files;
+    files.utterances = (directory / "Utterances.txt").string();
+    files.products = (directory / "Products.txt").string();
+    ofstream(files.utterances, ios::binary) << text;
+    ofstream(files.products, ios::binary) << products;
 
-            setColor(LIGHT_MAGENTA);
-            cout << "\nPress X to exit or any other key to continue: ";
-            setColor(BRIGHT_WHITE);
-            getline(cin, input);
-            if (toLower(trim(input)) == "x") {
-                displayGoodbyeScreen();
-                running = false;
+    int cores = maxThreads > 0 ? maxThreads : max(1, (int)thread::hardware_concurrency());
+    vector<int> threadCounts;
+    for (int threads = 1; threads < cores; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(cores);
+    int totalRows = rows[0] + rows[1] + rows[2];
+    double baseMs = 0;
+    int status = 0;
+    cout << fixed << setprecision(1);
+    cout << "  " << totalRows << " loan rows in 3 files, " << utterances << " utterances" << endl;
+    for (int threads : threadCounts) {
+        double bestMs = 0;
+        for (int repeat = 0; repeat < 3; repeat++) {
+            Catalog catalog;
+            auto start = chrono::steady_clock::now();
+            bool loaded = catalog.load(files, threads);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            if (!loaded || catalog.loanOptionCount != totalRows || catalog.utteranceCount - catalog.embeddedCount != utterances) {
+                cerr << "Error: the generated catalog did not load completely" << endl;
+                status = 1;
+                break;
             }
+            if (repeat == 0 || ms < bestMs) bestMs = ms;
         }
-        else if (lowerInput == "a") {
-           
-            continue;
-        }
+        if (status != 0) break;
+        if (threads == 1) baseMs = bestMs;
+        cout << "  " << setw(3) << threads << " thread(s): " << setw(8) << bestMs << " ms  "
+            << setw(6) << totalRows / bestMs / 1000 << " M rows/s  speedup " << setprecision(2) << baseMs / bestMs << setprecision(1) << endl;
     }
-}
 
-};
+    filesystem::remove_all(directory, error);
+    return status;
+}
 
     //======================================================
     // FUNCTION: main
     // Aim: Program entry point. Loads data files and runs the
     //      loan application chatbot.
+    //      --bench-lookup runs the utterance lookup benchmark.
+    //      --bench-render measures console rendering.
+    //      --bench-quotes measures load-time quoting against per-loan schedules.
+    //      --bench-match measures fuzzy intent matching.
+    //      --bench-normalize measures input normalization.
+    //      --bench-format measures amount formatting.
+    //      --bench-filter measures affordability queries.
+    //      --bench-load [threads] measures parallel catalog
+    //      loading.
+    //      --rate <percent> sets the annual interest rate.
+    //      --grouping lakh groups amounts as 12,34,567.
+    //      --watch reloads the data files when they change.
+    //      --replay <files> [--repeat n] replays recorded
+    //      conversations and reports turn latency.
+    //      --alloc-check checks heap allocations per turn.
+    //      --snapshot-check stresses catalog snapshot readers
+    //      against back-to-back publishes.
+    //      --metrics <path> writes metrics there on exit (and
+    //      on !metrics in serve mode); needs LOANBUDDY_METRICS.
+    //      --plan <product> <category> <option> <months>
+    //      [--format csv|json] exports one installment plan.
+    //      --batch-plans <output> [--format csv|columns]
+    //      [--terms a-b] [--threads n] exports every option's
+    //      plan for every term.
+    //      --compile-catalog [file] writes the binary catalog
+    //      image that later starts load instead of the text.
+    //      --serve [threads] answers the line protocol on
+    //      stdin/stdout instead of the console UI;
+    //      --sessions <dir> journals its sessions there.
     //======================================================
 
-    int main() {
+    int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench-lookup") {
+        return runLookupBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-render") {
+        return runRenderBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-quotes") {
+        return runQuoteBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-match") {
+        return runMatchBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--snapshot-check") {
+        return runSnapshotCheck();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-normalize") {
+        return runNormalizeBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-format") {
+        return runFormatBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-filter") {
+        return runFilterBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-load") {
+        return runLoadBenchmark(argc > 2 ? atoi(argv[2]) : 0);
+    }
+    if (argc > 1 && string(argv[1]) == "--compile-catalog") {
+        return compileCatalog(argc > 2 ? argv[2] : "Catalog.lbc");
+    }
+
+    bool serve = argc > 1 && string(argv[1]) == "--serve";
+    bool replay = argc > 1 && string(argv[1]) == "--replay";
+    bool allocCheck = argc > 1 && string(argv[1]) == "--alloc-check";
+    bool plan = argc > 1 && string(argv[1]) == "--plan";
+    bool batch = argc > 1 && string(argv[1]) == "--batch-plans";
     LoanApplicationSystem chatbot ; 
+    if (const char* rate = argumentValue(argc, argv, "--rate")) {
+        chatbot.setAnnualRate(atof(rate));
+    }
+    if (const char* grouping = argumentValue(argc, argv, "--grouping")) {
+        chatbot.setDigitGrouping(strcmp(grouping, "lakh") == 0 ? GROUP_LAKH : GROUP_WESTERN);
+    }
    
-    if (!chatbot.loadUtterances("Utterances.txt")) {
-     setColor(LIGHT_RED);
-     cout << "\nPress any key to exit...";
-     setColor(WHITE);
+    if (!chatbot.loadCatalog({ "Utterances.txt", "Products.txt", "Catalog.lbc", "Synonyms.txt" })) {
+     if (serve || replay || allocCheck || plan || batch) return 1;
+     Screen screen;
+     screen.color(LIGHT_RED) << "\nPress any key to exit...";
+     screen.color(WHITE).flush();
      cin.get();
      return 1;
     }
 
- 
-    chatbot.loadHomeLoanData("Home.txt");
-    chatbot.loadCarLoanData("Car.txt");
-    chatbot.loadBikeLoanData("Bike.txt");
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--watch") chatbot.watchCatalog(1000);
+    }
+
+    const char* metricsPath = argumentValue(argc, argv, "--metrics");
+#ifndef LOANBUDDY_METRICS
+    if (metricsPath != nullptr) {
+        cerr << "Warning: built without LOANBUDDY_METRICS, --metrics ignored" << endl;
+    }
+#endif
 
- 
-    chatbot.run();
-    return 0;
+    int status = 0;
+    if (serve) {
+        status = runServer(chatbot, argc > 2 && argv[2][0] != '-' ? atoi(argv[2]) : 0, metricsPath,
+            argumentValue(argc, argv, "--sessions"));
+    }
+    else if (allocCheck) {
+        status = runAllocationCheck(chatbot);
+    }
+    else if (plan) {
+        const char* format = argumentValue(argc, argv, "--format");
+        if (argc < 6 || !chatbot.exportPlan(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]),
+            format && strcmp(format, "json") == 0 ? PLAN_JSON : PLAN_CSV, stdout)) {
+            cerr << "Usage: --plan <product> <category> <option> <months 1-" << MAX_INSTALLMENTS
+                << "> [--format csv|json]" << endl;
+            status = 1;
+        }
+    }
+    else if (batch) {
+        status = runPlanBatch(chatbot, argc > 2 && (argv[2][0] != '-' || argv[2][1] == 0) ? argv[2] : nullptr,
+            argumentValue(argc, argv, "--format"), argumentValue(argc, argv, "--terms"), argumentValue(argc, argv, "--threads"));
+    }
+    else if (replay) {
+        vector<string> files;
+        for (int i = 2; i < argc && argv[i][0] != '-'; i++) files.push_back(argv[i]);
+        const char* repeat = argumentValue(argc, argv, "--repeat");
+        status = runReplay(chatbot, files, repeat ? max(atoi(repeat), 1) : 1);
+    }
+    else {
+        chatbot.run();
+    }
+
+#ifdef LOANBUDDY_METRICS
+    if (metricsPath != nullptr && !chatbot.dumpMetrics(metricsPath)) {
+        cerr << "Error: Could not write metrics to " << metricsPath << endl;
+    }
+#endif
+    return status;
 }
\ No newline at end of file